@@ -0,0 +1,30 @@
+#ifndef AREA_CONSTRAINT_H_
+#define AREA_CONSTRAINT_H_
+
+#include "constraint_batch.hpp"
+#include "precision.hpp"
+
+#include <vector>
+
+namespace pbd
+{
+
+// Keeps the signed area of a closed outline at pressure*rest_area. The
+// outline runs counter-clockwise through indices.
+struct AreaConstraint
+{
+  std::vector<int> indices;
+  Real rest_area;
+  Real pressure;
+  Real stiffness;
+
+  void Project(ConstraintContext& ctx) const;
+  void RemapIndices(const std::vector<int>& old_to_new);
+};
+
+// Signed area of the polygon, positive when counter-clockwise.
+Real GetPolygonArea(const PointCloud& pc, const std::vector<int>& indices);
+
+}
+
+#endif
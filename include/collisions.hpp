@@ -1,22 +1,55 @@
 #ifndef COLLISIONS_H_
 #define COLLISIONS_H_
 
+#include "geometry.hpp"
+#include "point_cloud.hpp"
+#include "rigid_body.hpp"
+#include "spatial_grid.hpp"
+#include "precision.hpp"
+
 #include <glm/glm.hpp>
 
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
-class PointCloud;
-
 namespace pbd
 {
 namespace collisions
 {
 
+// Two colliders touch when the category bits of each are in the mask of
+// the other. A shared nonzero group overrides the bits: positive groups
+// always collide, negative groups never do.
+struct CollisionFilter
+{
+  std::uint32_t category = 1;
+  std::uint32_t mask = ~std::uint32_t(0);
+  int group = 0;
+};
+
+inline bool ShouldCollide(const CollisionFilter& a, const CollisionFilter& b)
+{
+  if (a.group != 0 && a.group == b.group)
+    return a.group > 0;
+  return (a.category & b.mask) != 0 && (b.category & a.mask) != 0;
+}
+
+// Filters of a body's particles. Particles past the end of particles use
+// the body filter.
+struct BodyFilter
+{
+  CollisionFilter body;
+  std::vector<CollisionFilter> particles;
+};
+
 struct HalfPlane
 {
-  glm::dvec2 normal;
-  glm::dvec2 center;
-  double friction_coefficient;
+  Vec2 normal;
+  Vec2 center;
+  Real friction_coefficient;
+  CollisionFilter filter;
 };
 
 struct LineSeg
@@ -24,7 +57,7 @@ struct LineSeg
   PointCloud* pc;
   int idx1;
   int idx2;
-  double friction_coefficient;
+  Real friction_coefficient;
 };
 
 struct Point
@@ -39,45 +72,223 @@ struct Polygon
   std::vector<LineSeg> line_segments;
 };
 
+// A vertex of a rigid body penetrating by depth, the normal impulse that
+// resolves it and its tangential slip over the step.
+struct RigidContact
+{
+  RigidBody* body;
+  int vertex;
+  Vec2 point;
+  Real depth;
+  Real lambda;
+  Real slip;
+};
+
+// A point-segment pair that was apart when last measured. distance is a
+// lower bound on the distance between them, lowered on every pass by how
+// far their particles may have moved.
+struct PointLineSegSeparation
+{
+  int point;
+  int line_seg;
+  Real distance;
+};
+
+// Self-collision state of one body. points and segments index the
+// registered points and line segments. neighbors lists, per particle, the
+// particles within num_excluded_hops links along the body's segments,
+// starting at neighbor_offsets[i] and sorted.
+struct SelfCollider
+{
+  PointCloud* pc = nullptr;
+  int num_excluded_hops = 1;
+  bool topology_dirty = true;
+  std::vector<int> points;
+  std::vector<int> segments;
+  std::vector<int> neighbor_offsets;
+  std::vector<int> neighbors;
+  SpatialGrid grid{0.05};
+};
+
+// Contact features of a polygon pair, kept between substeps. The reference
+// face stays the same while it is nearly as good as the best one, so the
+// manifold of resting polygons does not flip between faces.
+struct PolygonManifold
+{
+  int reference;
+  int face;
+  int last_resolve;
+};
+
 bool DetectContinuousPointLineSegCollision(
-    glm::dvec2 p, glm::dvec2 p_prev,
-    glm::dvec2 q1, glm::dvec2 q2);
+    Vec2 p, Vec2 p_prev,
+    Vec2 q1, Vec2 q2);
 
-void ResolveHalfPlaneCollisions(PointCloud* pc, HalfPlane hp, double dt);
+// Optionally reports the deepest penetration that was resolved.
+int ResolveHalfPlaneCollisions(PointCloud* pc, HalfPlane hp, Real dt,
+    Real* max_penetration = nullptr);
+bool ResolveHalfPlaneCollision(PointCloud* pc, int i, HalfPlane hp, Real dt,
+    Real* max_penetration = nullptr);
 void ResolvePointLineSegCollision(
-    glm::dvec2 p, double pmass,
-    glm::dvec2 q1, double q1mass,
-    glm::dvec2 q2, double q2mass,
-    glm::dvec2* dp, glm::dvec2* dq1, glm::dvec2* dq2);
-void ResolvePolygonPointCollision(
+    Vec2 p, Real pmass,
+    Vec2 q1, Real q1mass,
+    Vec2 q2, Real q2mass,
+    Vec2* dp, Vec2* dq1, Vec2* dq2);
+bool ResolvePolygonPointCollision(
     Polygon poly,
     Point point,
-    double dt);
+    Real dt,
+    Real* penetration = nullptr);
+
+// Contacts resolved by the last ResolveCollisions call.
+struct CollisionStats
+{
+  int num_contacts = 0;
+  Real max_penetration = 0.0;
+};
 
 class Collisions
 {
 public:
   void AddPointCloud(PointCloud* pc);
+  // Registers the points of pc, in order, as the outline of a convex
+  // polygon that collides with registered points and other polygons.
   void AddPolygon(PointCloud *pc);
   void AddRod(PointCloud *pc);
   void AddLineSeg(PointCloud* pc, int idx1, int idx2,
-      double friction_coefficient);
+      Real friction_coefficient);
   void AddPoint(PointCloud* pc, int idx);
   void AddHalfPlane(
-      glm::dvec2 normal, glm::dvec2 center, double friction_coefficient);
-  void ResolveCollisions(double dt);
+      Vec2 normal, Vec2 center, Real friction_coefficient,
+      const CollisionFilter& filter = {});
+  // Rigid bodies collide with each other, with half-planes and with the
+  // particles of registered point clouds.
+  void AddRigidBody(RigidBody* body);
+  // Lets the registered points of pc collide with its own line segments.
+  // A point skips segments with an end within num_excluded_hops links of
+  // it, since those touch at rest.
+  void EnableSelfCollision(PointCloud* pc, int num_excluded_hops = 1);
+  // A body filter applies to all particles of pc and a particle filter
+  // overrides it for one. Line segments use the filter of their first
+  // particle and polygons the body filter. Excluded pairs are dropped
+  // when pairs are generated, before any narrowphase test.
+  void SetCollisionFilter(PointCloud* pc, const CollisionFilter& filter);
+  void SetCollisionFilter(
+      PointCloud* pc, int idx, const CollisionFilter& filter);
+  void SetCollisionFilter(RigidBody* body, const CollisionFilter& filter);
+  void ResolveCollisions(Real dt);
+  void RemapPointCloud(PointCloud* pc, const std::vector<int>& old_to_new);
+  int GetNumContacts() const { return stats_.num_contacts; }
+  const CollisionStats& GetStats() const { return stats_; }
+  void SetBroadphaseCellSize(Real cell_size);
+  // Finds the particle of a registered point cloud closest to p, within
+  // radius. Returns false if there is none.
+  bool FindNearestPoint(Vec2 p, Real radius, Point* nearest);
+  // Calls f(point) for every registered particle within radius of center.
+  // Uses the grid built by the last ResolveCollisions call, so particles
+  // that moved more than a grid cell since then may be missed.
+  template <typename F>
+  void ForEachPointInRadius(Vec2 center, Real radius, F&& f);
 
 private:
-  void ResolveAllHalfPlaneCollisions(double dt);
-  void ResolveAllPointLineSegCollisions(double dt);
-  void ResolveAllPolygonPointCollisions(double dt);
+  void UpdateBroadphase();
+  void UpdateFilters();
+  const CollisionFilter& GetFilter(const PointCloud* pc, int idx) const;
+  void ResolveAllHalfPlaneCollisions(Real dt);
+  void ResolveAllPointLineSegCollisions(Real dt);
+  // Takes indices of a registered point and line segment. Optionally
+  // reports the distance measured between them.
+  bool ResolvePointLineSegPair(int point, int line_seg, Real dt,
+      Real* penetration, Real* distance = nullptr);
+  void UpdateContactParticles();
+  void ResolveAllSelfCollisions(Real dt);
+  void UpdateSelfCollisionTopology(SelfCollider* sc);
+  void ResolveAllPolygonPointCollisions(Real dt);
+  void ResolveAllPolygonPolygonCollisions(Real dt);
+  int ResolvePolygonPairCollision(int i, int j, Real dt,
+      Real* max_penetration);
+  void ResolveAllRigidBodyCollisions(Real dt);
+  void ResolveRigidBodyHalfPlaneCollisions(int index);
+  void ResolveRigidBodyPairCollision(RigidBody* a, RigidBody* b);
+  void ResolveRigidBodyPointCollisions(int index, Real dt);
   std::vector<HalfPlane> half_planes_;
   std::vector<PointCloud*> point_clouds_;
   std::vector<LineSeg> line_segs_;
   std::vector<Point> points_;
   std::vector<Polygon> polygons_;
+  std::vector<SelfCollider> self_colliders_;
+  std::unordered_map<std::uint64_t, PolygonManifold> polygon_manifolds_;
+  std::vector<std::vector<Vec2>> polygon_vertices_;
+  std::vector<geometry::Rect> polygon_boxes_;
+  std::vector<int> polygon_order_;
+  std::vector<std::pair<int, int>> polygon_pairs_;
+  int num_resolves_ = 0;
+  std::vector<RigidBody*> rigid_bodies_;
+  std::vector<CollisionFilter> rigid_body_filters_;
+  std::vector<geometry::Rect> rigid_body_boxes_;
+  std::vector<int> rigid_body_order_;
+  std::vector<std::pair<int, int>> rigid_body_pairs_;
+  std::unordered_map<const PointCloud*, BodyFilter> body_filters_;
+  // Filters of the registered points, line segments and polygons, by
+  // index, refreshed when filters_dirty_ is set.
+  std::vector<CollisionFilter> point_filters_;
+  std::vector<CollisionFilter> line_seg_filters_;
+  std::vector<CollisionFilter> polygon_filters_;
+  bool filters_dirty_ = true;
+  std::vector<std::pair<int, int>> point_line_seg_pairs_;
+  // Particles of the registered points and line segments, with their
+  // positions at the start of the last point-segment pass, how far they
+  // may have moved since the one before and the last pass that corrected
+  // them.
+  std::vector<Point> contact_particles_;
+  std::vector<Vec2> contact_particle_positions_;
+  std::vector<Real> contact_particle_travel_;
+  std::vector<int> contact_particle_corrected_;
+  std::vector<int> point_particles_;
+  std::vector<std::pair<int, int>> line_seg_particles_;
+  bool contact_particles_dirty_ = true;
+  // Sorted by point, then line segment.
+  std::vector<PointLineSegSeparation> separations_;
+  std::vector<PointLineSegSeparation> next_separations_;
+  std::vector<int> polygon_point_candidates_;
+  std::vector<RigidContact> rigid_contacts_;
+  std::vector<Real> contact_lambdas_;
+  CollisionStats stats_;
+
+  // Particles of the point clouds, then registered points of other bodies,
+  // rebuilt once per ResolveCollisions call.
+  SpatialGrid point_grid_{0.05};
+  std::vector<Point> grid_points_;
+  std::vector<CollisionFilter> grid_filters_;
+  // Registered point of each entry, or -1.
+  std::vector<int> grid_registered_;
+  std::unordered_map<const PointCloud*, int> grid_cloud_offsets_;
+  int grid_num_cloud_entries_ = 0;
+  Real grid_max_radius_ = 0.0;
+  // Largest radius plus step displacement of a registered point.
+  Real grid_point_pad_ = 0.0;
+  bool broadphase_dirty_ = true;
 };
 
+template <typename F>
+void Collisions::ForEachPointInRadius(
+    Vec2 center, Real radius, F&& f)
+{
+  UpdateBroadphase();
+
+  const auto r2 = radius*radius;
+  const auto pad = point_grid_.GetCellSize();
+  point_grid_.QueryRadius(center, radius+pad, [&](int id)
+  {
+    if (id >= grid_num_cloud_entries_)
+      return;
+    const auto& pt = grid_points_[id];
+    const auto d = pt.pc->GetPoint(pt.idx) - center;
+    if (glm::dot(d, d) <= r2)
+      f(pt);
+  });
+}
+
 
 }
 }
@@ -0,0 +1,81 @@
+#ifndef CONSTRAINT_BATCH_H_
+#define CONSTRAINT_BATCH_H_
+
+#include "point_cloud.hpp"
+#include "precision.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace pbd
+{
+
+// What a constraint sees while it is being projected.
+struct ConstraintContext
+{
+  PointCloud* pc;
+  Real dt;
+  // How often each constraint is projected per step.
+  int num_projections;
+  Real over_relaxation;
+  Real max_correction2;
+
+  Vec2 GetPoint(int i) const { return pc->GetPoint(i); }
+  Real GetMass(int i) const { return pc->GetMass(i); }
+  void Displace(int i, Vec2 d)
+  {
+    d *= over_relaxation;
+    pc->DisplacePointAndUpdateVelocity(i, d, dt);
+    max_correction2 = std::max(max_correction2, glm::dot(d,d));
+  }
+};
+
+// Storage for all constraints of one type. A constraint type C provides
+//   void Project(ConstraintContext& ctx);
+//   void RemapIndices(const std::vector<int>& old_to_new);
+// Constraints are kept by value in one array per type, so a sweep costs one
+// virtual call per batch rather than per constraint.
+class ConstraintBatchBase
+{
+public:
+  virtual ~ConstraintBatchBase() = default;
+  virtual void Project(ConstraintContext& ctx) = 0;
+  virtual void RemapIndices(const std::vector<int>& old_to_new) = 0;
+  virtual int GetSize() const = 0;
+};
+
+template <typename C>
+class ConstraintBatch final : public ConstraintBatchBase
+{
+public:
+  void Add(const C& c) { constraints_.push_back(c); }
+  std::vector<C>& GetConstraints() { return constraints_; }
+  const std::vector<C>& GetConstraints() const { return constraints_; }
+
+  void Project(ConstraintContext& ctx) override
+  {
+    for (auto& c : constraints_)
+    {
+      c.Project(ctx);
+    }
+  }
+
+  void RemapIndices(const std::vector<int>& old_to_new) override
+  {
+    for (auto& c : constraints_)
+    {
+      c.RemapIndices(old_to_new);
+    }
+  }
+
+  int GetSize() const override { return constraints_.size(); }
+
+private:
+  std::vector<C> constraints_;
+};
+
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef CONSTRAINT_KERNELS_H_
+#define CONSTRAINT_KERNELS_H_
+
+#include <glm/glm.hpp>
+#include <glm/gtx/norm.hpp>
+
+#include <cmath>
+
+// Header-only constraint projections. Each kernel is a template over
+// policies so the solver can instantiate one fully inlined loop per
+// configuration instead of calling across translation units.
+namespace pbd
+{
+namespace kernels
+{
+
+// Stiffness policies map a constraint's stiffness in [0, 1] to the fraction
+// of the correction applied per projection.
+struct LinearStiffness
+{
+  template <typename T>
+  static constexpr T Apply(T stiffness, int /*num_iter*/)
+  {
+    return stiffness;
+  }
+};
+
+// Muller et al.: 1-(1-k)^(1/n), so the stiffness after n projections no
+// longer depends on n.
+struct IterationIndependentStiffness
+{
+  template <typename T>
+  static T Apply(T stiffness, int num_iter)
+  {
+    return 1 - std::pow(1 - stiffness, T(1)/num_iter);
+  }
+};
+
+// Mass policies give the inverse mass used to weight a correction.
+struct PerParticleMass
+{
+  template <typename T>
+  static constexpr T InverseMass(T mass) { return 1/mass; }
+};
+
+// All particles weigh the same, so the masses are never read.
+struct UniformMass
+{
+  template <typename T>
+  static constexpr T InverseMass(T /*mass*/) { return 1; }
+};
+
+// Pinning policies. A pinned particle has infinite mass and is never moved
+// by a constraint.
+struct NoPinning
+{
+  template <typename T>
+  static constexpr T Weight(T /*mass*/, T w) { return w; }
+  template <typename T>
+  static constexpr bool IsDegenerate(T /*total_weight*/) { return false; }
+};
+
+struct InfiniteMassPinning
+{
+  template <typename T>
+  static T Weight(T mass, T w) { return std::isinf(mass) ? T(0) : w; }
+  template <typename T>
+  static bool IsDegenerate(T total_weight) { return total_weight == 0; }
+};
+
+// One solver configuration, instantiated as a whole.
+template <typename StiffnessPolicy, typename MassPolicy,
+          typename PinningPolicy>
+struct Kernel
+{
+  using Stiffness = StiffnessPolicy;
+  using Mass = MassPolicy;
+  using Pinning = PinningPolicy;
+};
+
+template <typename T>
+struct LengthCorrection
+{
+  glm::tvec2<T> dp;
+  glm::tvec2<T> dq;
+  T C;
+};
+
+template <typename T>
+struct BendCorrection
+{
+  glm::tvec2<T> dp;
+  glm::tvec2<T> dq;
+  glm::tvec2<T> dr;
+  T C;
+};
+
+template <typename Stiffness, typename Mass, typename Pinning, typename T>
+inline LengthCorrection<T> ProjectLength(
+    glm::tvec2<T> p, T pmass,
+    glm::tvec2<T> q, T qmass,
+    T target_len, T stiffness, int num_iter)
+{
+  const auto u = q-p;
+  const auto ulen = glm::length(u);
+  const auto C = ulen - target_len;
+  const auto pw = Pinning::Weight(pmass, Mass::InverseMass(pmass));
+  const auto qw = Pinning::Weight(qmass, Mass::InverseMass(qmass));
+  // |dC/dp| = |dC/dq| = 1 for a distance constraint.
+  const auto w = pw + qw;
+  if (Pinning::IsDegenerate(w))
+  {
+    return {{0, 0}, {0, 0}, C};
+  }
+  const auto n = u/ulen;
+  const auto s = C/w*Stiffness::Apply(stiffness, num_iter);
+  return {s*pw*n, -s*qw*n, C};
+}
+
+template <typename Stiffness, typename Mass, typename Pinning, typename T>
+inline BendCorrection<T> ProjectBend(
+    glm::tvec2<T> p, T pmass,
+    glm::tvec2<T> q, T qmass,
+    glm::tvec2<T> r, T rmass,
+    T segment_length, T stiffness, int num_iter)
+{
+  const glm::tvec2<T> zero{0, 0};
+  const auto u = q-p;
+  const auto v = r-q;
+  const glm::tvec2<T> uperp{u.y, -u.x};
+  const glm::tvec2<T> vperp{v.y, -v.x};
+  const auto ulen = glm::length(u);
+  const auto vlen = glm::length(v);
+  const auto udotv = glm::dot(u,v);
+  const auto udotvperp = glm::dot(u,vperp);
+  if (glm::abs(ulen*vlen+udotv) < T(1e-10))
+  {
+    return {zero, zero, zero, 0};
+  }
+  const auto ub = u/ulen;
+  const auto vb = v/vlen;
+  const auto uperpb = uperp/ulen;
+  const auto vperpb = vperp/vlen;
+  const auto a = 1/(ulen*vlen+udotv);
+  const auto dbdu = 2*a*vlen*(vperpb - udotvperp*a*(ub+vb));
+  const auto dbdv = -2*a*ulen*(uperpb + udotvperp*a*(ub+vb));
+  const auto b = 2*udotvperp*a/segment_length;
+  const auto dCdu = 2*b*dbdu/segment_length;
+  const auto dCdv = 2*b*dbdv/segment_length;
+
+  const auto dCdp = -dCdu;
+  const auto dCdq = dCdu-dCdv;
+  const auto dCdr = dCdv;
+  const auto C = b*b;
+  if (C < T(1e-10))
+  {
+    return {zero, zero, zero, C};
+  }
+  const auto pw = Pinning::Weight(pmass, Mass::InverseMass(pmass));
+  const auto qw = Pinning::Weight(qmass, Mass::InverseMass(qmass));
+  const auto rw = Pinning::Weight(rmass, Mass::InverseMass(rmass));
+  const auto w = pw*glm::length2(dCdp) +
+                 qw*glm::length2(dCdq) +
+                 rw*glm::length2(dCdr);
+  if (Pinning::IsDegenerate(w))
+  {
+    return {zero, zero, zero, C};
+  }
+  const auto s = C/w*Stiffness::Apply(stiffness, num_iter);
+  return {-s*pw*dCdp, -s*qw*dCdq, -s*rw*dCdr, C};
+}
+
+}
+}
+
+#endif
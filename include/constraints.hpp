@@ -1,24 +1,38 @@
+#include "precision.hpp"
+
 #include <glm/glm.hpp>
 
+#include <vector>
+
 namespace pbd
 {
 
-void GetLengthConstraintDelta(
-    glm::dvec2 p, double pmass,
-    glm::dvec2 q, double qmass,
-    double target_len,
-    double stiffness,
-    glm::dvec2* dp,
-    glm::dvec2* dq);
+// Both return the constraint value C before the correction.
+Real GetLengthConstraintDelta(
+    Vec2 p, Real pmass,
+    Vec2 q, Real qmass,
+    Real target_len,
+    Real stiffness,
+    Vec2* dp,
+    Vec2* dq);
+
+Real GetBendConstraintDelta(
+    Vec2 p, Real pmass,
+    Vec2 q, Real qmass,
+    Vec2 r, Real rmass,
+    Real segment_length,
+    Real stiffness,
+    Vec2* dp,
+    Vec2* dq,
+    Vec2* dr);
 
-void GetBendConstraintDelta(
-    glm::dvec2 p, double pmass,
-    glm::dvec2 q, double qmass,
-    glm::dvec2 r, double rmass,
-    double segment_length,
-    double stiffness,
-    glm::dvec2* dp,
-    glm::dvec2* dq,
-    glm::dvec2* dr);
+// Thomas algorithm for a tridiagonal system with sub-diagonal a, diagonal b
+// and super-diagonal c. a[0] and c[n-1] are unused. The solution replaces
+// d, and c is used as scratch.
+void SolveTridiagonal(
+    const std::vector<Real>& a,
+    const std::vector<Real>& b,
+    std::vector<Real>* c,
+    std::vector<Real>* d);
 
 }
@@ -0,0 +1,56 @@
+#ifndef FORCE_FIELD_H_
+#define FORCE_FIELD_H_
+
+#include "precision.hpp"
+
+#include <glm/glm.hpp>
+
+#include <utility>
+#include <vector>
+
+namespace pbd
+{
+
+namespace collisions
+{
+class Collisions;
+}
+
+enum class ForceFieldType{Radial, Directional, Vortex, Drag};
+
+// A force acting on particles within radius of center. The magnitude falls
+// off linearly to zero at the radius. Radial fields push away from the
+// center for positive strength, vortex fields turn counter-clockwise for
+// positive strength and drag fields oppose velocity.
+struct ForceField
+{
+  ForceFieldType type;
+  Vec2 center;
+  Vec2 direction;
+  Real strength;
+  Real radius;
+};
+
+Vec2 EvaluateForceField(
+    const ForceField& field, Vec2 p, Vec2 v);
+
+class ForceFieldSet
+{
+public:
+  int AddField(const ForceField& field);
+  void RemoveField(int handle);
+  ForceField* GetField(int handle);
+  bool IsEmpty() const { return fields_.empty(); }
+
+  // Adds the field forces to the registered particles in range, using the
+  // broadphase grid of collisions.
+  void Apply(collisions::Collisions* collisions) const;
+
+private:
+  std::vector<std::pair<int, ForceField>> fields_;
+  int next_handle_ = 0;
+};
+
+}
+
+#endif
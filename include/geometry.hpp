@@ -1,50 +1,86 @@
 #ifndef GEOMETRY_H_
 #define GEOMETRY_H_
 
+#include "precision.hpp"
+
 #include <glm/glm.hpp>
 
+#include <vector>
+
 namespace geometry
 {
+using pbd::Real;
+using pbd::Vec2;
+
 bool LinesegLinesegIntersection(
-    const glm::dvec2& p1,
-    const glm::dvec2& p2,
-    const glm::dvec2& q1,
-    const glm::dvec2& q2,
-    glm::dvec2* intersection_point);
-
-double PointLinesegDistance(
-    const glm::dvec2& v,
-    const glm::dvec2& e1,
-    const glm::dvec2& e2,
-    glm::dvec2* closest_point);
-
-double PointLinesegDistance(
-    const glm::dvec2& v,
-    const glm::dvec2& e1,
-    const glm::dvec2& e2);
-
-double PointLineDistance(
-    const glm::dvec2& v,
-    const glm::dvec2& point_on_line,
-    const glm::dvec2& normal);
-
-double PointLineSignedDistance(
-    const glm::dvec2& v,
-    const glm::dvec2& point_on_line,
-    const glm::dvec2& normal);
+    const Vec2& p1,
+    const Vec2& p2,
+    const Vec2& q1,
+    const Vec2& q2,
+    Vec2* intersection_point);
+
+Real PointLinesegDistance(
+    const Vec2& v,
+    const Vec2& e1,
+    const Vec2& e2,
+    Vec2* closest_point);
+
+Real PointLinesegDistance(
+    const Vec2& v,
+    const Vec2& e1,
+    const Vec2& e2);
+
+Real PointLineDistance(
+    const Vec2& v,
+    const Vec2& point_on_line,
+    const Vec2& normal);
+
+Real PointLineSignedDistance(
+    const Vec2& v,
+    const Vec2& point_on_line,
+    const Vec2& normal);
 
 bool RayLinesegIntersection(
-    const glm::dvec2& ray_origin,
-    const glm::dvec2& ray_direction,
-    const glm::dvec2& p1,
-    const glm::dvec2& p2,
-    glm::dvec2* intersection_point);
+    const Vec2& ray_origin,
+    const Vec2& ray_direction,
+    const Vec2& p1,
+    const Vec2& p2,
+    Vec2* intersection_point);
+
+Real Cross(
+    const Vec2& u,
+    const Vec2& v);
+
+bool PointInPolygon(
+    const Vec2& v,
+    const std::vector<Vec2>& polygon);
+
+// Largest signed distance of polygon b from any face of polygon a, both
+// convex and counter-clockwise. Positive means a separating axis exists.
+// face is set to the index of the face of a that realizes it.
+Real FindMaxSeparation(
+    const std::vector<Vec2>& a,
+    const std::vector<Vec2>& b,
+    int* face);
+
+// Clips segment p1-p2 to the slab between the lines through a and b that
+// are perpendicular to b-a. On success s1 <= s2 are the segment parameters
+// of the kept part, p1 + s*(p2-p1).
+bool ClipSegmentToSlab(
+    const Vec2& p1,
+    const Vec2& p2,
+    const Vec2& a,
+    const Vec2& b,
+    Real* s1,
+    Real* s2);
+
+struct Rect { Real x1, x2, y1, y2; };
+
+bool RectsOverlap(const Rect& a, const Rect& b);
 
-double Cross(
-    const glm::dvec2& u,
-    const glm::dvec2& v);
+bool RectContainsRect(const Rect& outer, const Rect& inner);
 
-struct Rect { double x1, x2, y1, y2; };
+bool RectContainsPoint(const Rect& r, const Vec2& p);
 }
 
 #endif
@@ -0,0 +1,23 @@
+#ifndef MORTON_H_
+#define MORTON_H_
+
+#include "precision.hpp"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace pbd
+{
+
+uint32_t MortonCode(uint32_t x, uint32_t y);
+
+// Returns a permutation new_to_old that sorts the points along a Z-order
+// curve over their bounding box.
+std::vector<int> ComputeMortonOrder(const std::vector<Vec2>& points);
+
+std::vector<int> InvertPermutation(const std::vector<int>& permutation);
+
+}
+
+#endif
@@ -3,17 +3,30 @@
 
 #include "pbd_system.hpp"
 #include "point_cloud.hpp"
+#include "shape_matching.hpp"
 #include <memory>
 
 namespace pbd
 {
 
 std::unique_ptr<PbdSystem> MakeRod(
-    double length, double mass, int num_edges,
-    double stretch_resistance, double bend_resistance);
+    Real length, Real mass, int num_edges,
+    Real stretch_resistance, Real bend_resistance);
 
 std::unique_ptr<PbdSystem> MakeSquare(
-    double side_length, double stiffness);
+    Real side_length, Real stiffness);
+
+// A ring of particles held by its edge lengths and a single area
+// constraint. pressure scales the target area relative to the rest shape.
+std::unique_ptr<PbdSystem> MakeSoftBody(
+    Real radius, int num_vertices, Real mass,
+    Real stiffness, Real pressure);
+
+// A grid of nx by ny particles kept in shape by one shape matching
+// constraint instead of length constraints.
+std::unique_ptr<PbdSystem> MakeShapeMatchingBox(
+    Real width, Real height, int nx, int ny, Real mass,
+    Real stiffness, ShapeMatchingMode mode);
 
 }
 
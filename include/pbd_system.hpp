@@ -1,39 +1,106 @@
 #ifndef PBD_SYSTEM_H_
 #define PBD_SYSTEM_H_
 
+#include "constraint_batch.hpp"
 #include "point_cloud.hpp"
+#include "precision.hpp"
 
 #include <glm/glm.hpp>
 #include <memory>
+#include <typeindex>
 #include <vector>
 
 
 namespace pbd
 {
 
+// Constraint errors measured just before the final projection of each
+// constraint in a step. Length errors are in world units, bend errors are
+// curvatures.
+struct SolverResiduals
+{
+  Real max_length_error = 0.0;
+  Real rms_length_error = 0.0;
+  Real max_bend_error = 0.0;
+  Real rms_bend_error = 0.0;
+  int num_iterations = 0;
+  std::vector<int> length_error_histogram;
+};
+
+// Linear scales each projection by the constraint's stiffness.
+// IterationIndependent adjusts it for the number of projections per step,
+// so the stiffness does not change with the iteration count.
+enum class StiffnessModel{Linear, IterationIndependent};
+
 class PbdSystem : public PointCloud
 {
 public:
   using PointCloud::PointCloud;
-  void Integrate(double dt) override;
-  void DampVelocity(double damping);
+  void Integrate(Real dt) override;
+  void DampVelocity(Real damping);
+  void ReorderPoints(const std::vector<int>& new_to_old) override;
   void AddLengthConstraint(
       int idx1, int idx2,
-      double target_len, double stiffness, int num_iter);
+      Real target_len, Real stiffness, int num_iter);
   void AddBendConstraint(
       int idx1, int idx2, int idx3,
-      double target_angle, double stiffness, int num_iter);
+      Real target_angle, Real stiffness, int num_iter);
+  int GetNumLengthConstraints() const;
+  int GetNumBendConstraints() const;
+  // Adds a constraint of any type meeting the interface described in
+  // constraint_batch.hpp. Custom constraints are projected once per sweep,
+  // after the length and bend constraints.
+  template <typename C>
+  void AddConstraint(const C& c);
+  template <typename C>
+  ConstraintBatch<C>& GetConstraintBatch();
+  // All constraints, built-in and custom.
+  int GetNumConstraints() const;
+  // Projects each length constraint as soon as its last particle has been
+  // predicted, sharing one pass over memory with the integration. The first
+  // sweep then visits constraints by particle index rather than in the
+  // order they were added, and is profiled as LengthConstraints. Off by
+  // default.
+  void SetFusedIntegration(bool on);
+  // With num_iterations > 0 the per-constraint num_iter is ignored and all
+  // length and bend constraints are swept together up to num_iterations
+  // times per step. Iteration stops early once the largest position
+  // correction of a sweep is below tolerance.
+  void SetSolverIterations(int num_iterations, Real tolerance);
+  int GetNumIterationsLastStep() const { return num_iterations_last_step_; }
+  const SolverResiduals& GetResiduals() const { return residuals_; }
+  // Bins length errors over [0, max_error], the last bin also counting
+  // larger errors and NaN. Zero bins or a max_error that is not positive
+  // disables the histogram.
+  void SetErrorHistogram(int num_bins, Real max_error);
+  // Scales every constraint correction by omega (successive
+  // over-relaxation). 1 is plain Gauss-Seidel; values up to about 1.5 speed
+  // up stiff chains, values near 2 diverge.
+  void SetOverRelaxation(Real omega);
+  // Chebyshev semi-iterative acceleration of the global iterations, see
+  // SetSolverIterations. spectral_radius estimates the convergence rate of
+  // a plain sweep, 0 disables it and values are capped at 0.95. Around 0.9
+  // is a safe start. While it is active, over-relaxation is ignored.
+  void SetChebyshevAcceleration(Real spectral_radius);
+  // If the length constraints form a single open chain, as in MakeRod, each
+  // sweep solves them together with two direct tridiagonal solves of the
+  // linearized system instead of projecting them one at a time. Other
+  // topologies keep the Gauss-Seidel sweep.
+  void SetDirectChainSolve(bool on);
+  void SetStiffnessModel(StiffnessModel model);
 
 private:
-  void HandleLengthConstraints(double dt);
-  void HandleBendConstraints(double dt);
+  void IntegrateAndHandleLengthConstraints(Real dt);
+  void HandleLengthConstraints(Real dt);
+  void HandleBendConstraints(Real dt);
+  void HandleCustomConstraints(Real dt);
 
   struct LengthConstraint
   {
     int idx1;
     int idx2;
-    double target_len;
-    double stiffness;
+    Real target_len;
+    Real stiffness;
     int num_iter;
   };
 
@@ -42,14 +109,112 @@ private:
     int idx1;
     int idx2;
     int idx3;
-    double segment_length;
-    double stiffness;
+    Real segment_length;
+    Real stiffness;
     int num_iter;
   };
 
+  struct ChainLink
+  {
+    Real target_len;
+    Real stiffness;
+  };
+
+  // Each sweep is instantiated per kernel configuration, chosen from the
+  // stiffness model and the current masses. Particles with infinite mass
+  // are pinned.
+  template <typename F>
+  void DispatchKernel(F&& f);
+  template <typename Stiffness, typename F>
+  void DispatchMassModel(F&& f);
+  void UpdateMassModel();
+  template <typename Kernel>
+  void IntegrateAndSweepLengthConstraints(Real dt);
+  template <typename Kernel>
+  void ProjectLengthConstraint(const LengthConstraint& c, Real dt);
+  template <typename Kernel>
+  void SweepBendConstraints(Real dt);
+  bool UpdateChain();
+  void SolveLengthChain(Real dt);
+  void UpdateFusedOrder();
+  void ApplyChebyshevStep(Real omega, Real dt);
+  bool IsChebyshevActive() const;
+  Real GetOverRelaxation() const;
+  void ResetLengthResiduals();
+  void AddLengthResidual(Real error);
+
+  struct ErrorAccumulator
+  {
+    Real max = 0.0;
+    Real sum2 = 0.0;
+    int count = 0;
+  };
+
   std::vector<LengthConstraint> length_constraints_;
   std::vector<BendConstraint> bend_constraints_;
+
+  bool fused_integration_ = false;
+  bool fused_order_dirty_ = true;
+  // Indices into length_constraints_ in the order of the fused pass.
+  std::vector<int> fused_order_;
+
+  int num_solver_iterations_ = 0;
+  Real solver_tolerance_ = 0.0;
+  int num_iterations_last_step_ = 0;
+  Real max_correction2_ = 0.0;
+
+  Real over_relaxation_ = 1.0;
+  Real spectral_radius_ = 0.0;
+  std::vector<Vec2> chebyshev_last_;
+  std::vector<Vec2> chebyshev_before_last_;
+
+  std::vector<std::unique_ptr<ConstraintBatchBase>> constraint_batches_;
+  std::vector<std::type_index> constraint_batch_types_;
+
+  StiffnessModel stiffness_model_ = StiffnessModel::Linear;
+  // Mass revision the kernel configuration was last chosen for.
+  int mass_model_revision_ = -1;
+  bool uniform_mass_ = false;
+  bool has_pinned_points_ = false;
+
+  bool direct_chain_solve_ = false;
+  bool chain_dirty_ = true;
+  // Particles of the chain in path order, link j joining particles j, j+1.
+  std::vector<int> chain_points_;
+  std::vector<ChainLink> chain_links_;
+  std::vector<Vec2> chain_normals_;
+  std::vector<Real> chain_lower_;
+  std::vector<Real> chain_diag_;
+  std::vector<Real> chain_upper_;
+  std::vector<Real> chain_lambda_;
+
+  SolverResiduals residuals_;
+  ErrorAccumulator length_errors_;
+  ErrorAccumulator bend_errors_;
+  Real histogram_max_error_ = 0.0;
 };
 
+template <typename C>
+void PbdSystem::AddConstraint(const C& c)
+{
+  GetConstraintBatch<C>().Add(c);
+}
+
+template <typename C>
+ConstraintBatch<C>& PbdSystem::GetConstraintBatch()
+{
+  const std::type_index type(typeid(C));
+  for (int i = 0; i < constraint_batch_types_.size(); ++i)
+  {
+    if (constraint_batch_types_[i] == type)
+    {
+      return static_cast<ConstraintBatch<C>&>(*constraint_batches_[i]);
+    }
+  }
+  constraint_batches_.push_back(std::make_unique<ConstraintBatch<C>>());
+  constraint_batch_types_.push_back(type);
+  return static_cast<ConstraintBatch<C>&>(*constraint_batches_.back());
+}
+
 }
 #endif
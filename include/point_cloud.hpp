@@ -1,48 +1,84 @@
 #ifndef POINTCLOUD_H_
 #define POINTCLOUD_H_
 
+#include "geometry.hpp"
+#include "precision.hpp"
+
+#include <cmath>
 #include <vector>
 #include <glm/glm.hpp>
 
+// PerCorrection adds d/dt to the velocity on every displacement.
+// FromPositions only moves positions while solving and derives velocities
+// once per step in UpdateVelocities.
+enum class VelocityUpdate{PerCorrection, FromPositions};
+
 class PointCloud
 {
 public:
   PointCloud(int num_points);
-  virtual void Integrate(double dt);
-  void DisplacePoint(int i, glm::dvec2 d);
-  void DisplacePointAndUpdateVelocity(int i, glm::dvec2 d, double dt);
-  void DisplaceCloud(glm::dvec2 d);
-  void AddVelocity(int i, glm::dvec2 v);
-  void AddForce(int i, glm::dvec2 F);
-  void SetGravity(glm::dvec2 g);
-  void SpawnNewPoints(std::vector<glm::dvec2> v);
+  virtual void Integrate(pbd::Real dt);
+  void DisplacePoint(int i, pbd::Vec2 d);
+  void DisplacePointAndUpdateVelocity(int i, pbd::Vec2 d, pbd::Real dt);
+  void DisplaceCloud(pbd::Vec2 d);
+  // Call once per step after all constraint and collision corrections.
+  void UpdateVelocities(pbd::Real dt);
+  void AddVelocity(int i, pbd::Vec2 v);
+  // Forces accumulate until the next Integrate, which consumes them.
+  void AddForce(int i, pbd::Vec2 F);
+  void SetGravity(pbd::Vec2 g);
+  pbd::Vec2 GetGravity() const { return gravity_; }
+  void SpawnNewPoints(std::vector<pbd::Vec2> v);
   void RemoveAllPoints();
-  glm::dvec2 GetMomentum() const;
+  virtual void ReorderPoints(const std::vector<int>& new_to_old);
+  pbd::Vec2 GetMomentum() const;
 
   //setters & getters
   int GetNumPoints() const;
-  std::vector<glm::dvec2> GetPoints() const;
-  glm::dvec2 GetPoint(int i) const;
-  glm::dvec2 GetPointFromPreviousTimestep(int i) const;
-  void SetPoint(int i, glm::dvec2 p);
-  glm::dvec2 GetVelocity(int i) const;
-  void SetVelocity(int i, glm::dvec2 v);
-  void SetMass(int i, double m);
-  void SetRadii(double r);
-  double GetRadius(int i) const;
-  double GetMass(int i) const;
-  void SetForce(int i, glm::dvec2 F);
-  glm::dvec2 GetCenterOfMass() const;
+  const std::vector<pbd::Vec2>& GetPoints() const;
+  pbd::Vec2 GetPoint(int i) const;
+  pbd::Vec2 GetPointFromPreviousTimestep(int i) const;
+  void SetPoint(int i, pbd::Vec2 p);
+  pbd::Vec2 GetVelocity(int i) const;
+  void SetVelocity(int i, pbd::Vec2 v);
+  void SetMass(int i, pbd::Real m);
+  void SetRadii(pbd::Real r);
+  pbd::Real GetRadius(int i) const;
+  pbd::Real GetMass(int i) const;
+  // Changes whenever a mass may have changed.
+  int GetMassRevision() const { return mass_revision_; }
+  void SetForce(int i, pbd::Vec2 F);
+  void SetVelocityUpdate(VelocityUpdate mode);
+  VelocityUpdate GetVelocityUpdate() const { return velocity_update_; }
+  pbd::Vec2 GetCenterOfMass() const;
+  geometry::Rect GetBoundingBox() const;
+
+protected:
+  // Saves the previous position and predicts the new one for point i. Lets
+  // derived solvers fuse integration with their first constraint sweep.
+  void IntegratePoint(int i, pbd::Real dt)
+  {
+    points_from_prev_timestep_[i] = points_[i];
+    // Pinned particles have infinite mass and stay put.
+    if (!std::isinf(masses_[i]))
+    {
+      velocities_[i] += forces_[i]*dt/masses_[i] + gravity_*dt;
+      points_[i] += velocities_[i]*dt;
+    }
+    forces_[i] = {0.0, 0.0};
+  }
 
 private:
   int num_points_;
-  std::vector<glm::dvec2> points_;
-  std::vector<glm::dvec2> points_from_prev_timestep_;
-  std::vector<glm::dvec2> velocities_;
-  std::vector<glm::dvec2> forces_;
-  std::vector<double> masses_;
-  std::vector<double> radii_;
-  glm::dvec2 gravity_{0.0,0.0};
+  std::vector<pbd::Vec2> points_;
+  std::vector<pbd::Vec2> points_from_prev_timestep_;
+  std::vector<pbd::Vec2> velocities_;
+  std::vector<pbd::Vec2> forces_;
+  std::vector<pbd::Real> masses_;
+  int mass_revision_ = 0;
+  std::vector<pbd::Real> radii_;
+  pbd::Vec2 gravity_{0.0,0.0};
+  VelocityUpdate velocity_update_ = VelocityUpdate::PerCorrection;
 };
 
 #endif
@@ -0,0 +1,22 @@
+#ifndef PRECISION_H_
+#define PRECISION_H_
+
+#include <glm/glm.hpp>
+
+namespace pbd
+{
+
+// Scalar and vector types used by the simulation. The library is built in
+// double precision unless PBD2D_USE_FLOAT is defined. Both builds use the
+// same namespaces and symbol names, so a program links one of them only,
+// and its own sources must agree on PBD2D_USE_FLOAT.
+#ifdef PBD2D_USE_FLOAT
+using Real = float;
+#else
+using Real = double;
+#endif
+using Vec2 = glm::tvec2<Real>;
+
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace pbd
+{
+namespace profiler
+{
+
+enum class Stage
+{
+  Step,
+  Integrate,
+  LengthConstraints,
+  BendConstraints,
+  PointLineSegCollisions,
+  HalfPlaneCollisions,
+  PolygonPointCollisions,
+  CustomConstraints,
+  RigidBodyCollisions,
+  PolygonPolygonCollisions,
+  SelfCollisions,
+  NumStages
+};
+
+struct Sample
+{
+  Stage stage;
+  int64_t start_ns;
+  int64_t duration_ns;
+  int64_t num_tested;
+  int64_t num_hits;
+};
+
+const char* GetStageName(Stage stage);
+int64_t NowNs();
+
+// Appends a sample to the ring buffer. Safe to call concurrently with
+// readers; there must be at most one writing thread.
+void Record(const Sample& sample);
+
+// Returns the buffered samples, oldest first.
+std::vector<Sample> GetSamples();
+void Clear();
+void WriteChromeTrace(std::ostream& os);
+
+// Nested stages accumulate into per-thread totals which are recorded as one
+// sample per stage when the enclosing Stage::Step timer goes out of scope.
+class ScopedTimer
+{
+public:
+  explicit ScopedTimer(Stage stage);
+  ~ScopedTimer();
+  void AddTested(int64_t n) { num_tested_ += n; }
+  void AddHits(int64_t n) { num_hits_ += n; }
+
+private:
+  Stage stage_;
+  int64_t start_ns_;
+  int64_t num_tested_ = 0;
+  int64_t num_hits_ = 0;
+};
+
+}
+}
+
+#ifdef PBD2D_PROFILE
+#define PBD_PROFILE_SCOPE(timer, stage) \
+  ::pbd::profiler::ScopedTimer timer(::pbd::profiler::Stage::stage)
+#define PBD_PROFILE_TESTED(timer, n) timer.AddTested(n)
+#define PBD_PROFILE_HITS(timer, n) timer.AddHits(n)
+#else
+#define PBD_PROFILE_SCOPE(timer, stage) do {} while (0)
+#define PBD_PROFILE_TESTED(timer, n) do {} while (0)
+#define PBD_PROFILE_HITS(timer, n) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef RIGID_BODY_H_
+#define RIGID_BODY_H_
+
+#include "geometry.hpp"
+#include "precision.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace pbd
+{
+
+// Convex polygon moving as one rigid body. Like the particles, its pose is
+// predicted in Integrate, corrected by contacts, and its velocities are
+// derived from the corrected pose in UpdateVelocities.
+class RigidBody
+{
+public:
+  // vertices are counter-clockwise around the origin of the body frame,
+  // which is moved to the center of mass.
+  RigidBody(std::vector<Vec2> vertices, Real mass);
+
+  void Integrate(Real dt);
+  void UpdateVelocities(Real dt);
+  // Applies a positional impulse at world point p.
+  void ApplyPositionImpulse(Vec2 impulse, Vec2 p);
+  // Inverse mass felt by a positional impulse along n at world point p.
+  Real GetGeneralizedInverseMass(Vec2 p, Vec2 n) const;
+  // Where the material point now at world point p was before the step.
+  Vec2 GetPreviousPosition(Vec2 p) const;
+
+  Vec2 GetPosition() const { return position_; }
+  void SetPosition(Vec2 p) { position_ = p; }
+  Real GetAngle() const { return angle_; }
+  void SetAngle(Real angle) { angle_ = angle; }
+  Vec2 GetVelocity() const { return velocity_; }
+  void SetVelocity(Vec2 v) { velocity_ = v; }
+  Real GetAngularVelocity() const { return angular_velocity_; }
+  void SetAngularVelocity(Real w) { angular_velocity_ = w; }
+  Vec2 GetGravity() const { return gravity_; }
+  void SetGravity(Vec2 g) { gravity_ = g; }
+  Real GetInverseMass() const { return inverse_mass_; }
+  Real GetInverseInertia() const { return inverse_inertia_; }
+  // Coulomb friction coefficient against other rigid bodies.
+  void SetFriction(Real friction) { friction_ = friction; }
+  Real GetFriction() const { return friction_; }
+
+  const std::vector<Vec2>& GetLocalVertices() const { return vertices_; }
+  const std::vector<Vec2>& GetWorldVertices() const;
+  geometry::Rect GetBoundingBox() const;
+
+private:
+  std::vector<Vec2> vertices_;
+  Vec2 position_{0.0, 0.0};
+  Vec2 prev_position_{0.0, 0.0};
+  Vec2 velocity_{0.0, 0.0};
+  Vec2 gravity_{0.0, 0.0};
+  Real angle_ = 0;
+  Real prev_angle_ = 0;
+  Real angular_velocity_ = 0;
+  Real inverse_mass_;
+  Real inverse_inertia_;
+  Real friction_ = 0.5;
+
+  mutable std::vector<Vec2> world_vertices_;
+};
+
+// A w by h box centered on its center of mass.
+RigidBody MakeRigidBox(Real width, Real height, Real mass);
+
+}
+
+#endif
@@ -4,11 +4,19 @@
 #include "pbd_system.hpp"
 
 #include "collisions.hpp"
+#include "force_field.hpp"
+#include "geometry.hpp"
+#include "triple_buffer.hpp"
 
+#include <array>
+#include <atomic>
+#include <functional>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <stdint.h>
+#include <thread>
 #include <vector>
 
 #include <glm/glm.hpp>
@@ -19,7 +27,37 @@ class Camera;
 namespace sandbox {
 
 enum class Direction{Up, Down, Left, Right};
-enum class Selection{Hover, Selected};
+enum class RegionMode{Box, Lasso};
+
+// Selected particles of one body, sorted by index, and the offset each keeps
+// to the attractor point while the selection is dragged.
+struct BodySelection
+{
+  std::vector<int> indices;
+  std::vector<glm::dvec2> offsets;
+};
+
+struct BodySnapshot
+{
+  std::vector<glm::dvec2> points;
+  geometry::Rect bounding_box;
+  int num_constraints = 0;
+};
+
+// State published by the physics step for rendering and input.
+struct RenderSnapshot
+{
+  std::vector<BodySnapshot> bodies;
+  // World space outlines of the rigid bodies.
+  std::vector<std::vector<glm::dvec2>> rigid_bodies;
+  std::vector<glm::dvec2> selected_points;
+  int num_contacts = 0;
+  double max_penetration = 0.0;
+  double max_length_error = 0.0;
+  double max_bend_error = 0.0;
+  int num_solver_iterations = 0;
+  int64_t step_count = 0;
+};
 
 class Sandbox
 {
@@ -30,43 +68,109 @@ public:
   void Quit();
   bool IsRunning() const;
 
+  // When threaded, physics runs on its own thread at the fixed physics rate
+  // and the methods below that modify the scene are queued to it.
+  void SetThreadedPhysics(bool on);
+  bool IsPhysicsThreaded() const { return physics_thread_.joinable(); }
+  const RenderSnapshot& GetSnapshot() const
+  {
+    return snapshots_.GetReadBuffer();
+  }
+
   //Camera control
   Camera* GetCamera() const { return camera_.get(); }
   void Pan(Direction d, bool on);
   glm::dvec2 GetPanDirection();
 
   //Geometry control
+  //Direct accessors are only safe to use when physics is not threaded.
   const auto& GetPbds() const { return pbds_; }
   pbd::PbdSystem* GetPbd(int idx) const { return pbds_[idx].get(); }
   glm::dvec2 GetPoint(int pdb_idx, int point_idx) const;
   double GetPointRadius() const { return point_radius_; }
   const auto& GetSelections() const { return selections_; }
-  void SelectPoint(int pbd_idx, int point_idx, Selection type);
+  void SelectPoint(int pbd_idx, int point_idx);
+  void SelectNearestPoint(glm::dvec2 p, double radius);
+  void SelectRegion(std::vector<glm::dvec2> polygon);
+  void GrabSelection(glm::dvec2 p);
   void SetAttractorPoint(glm::dvec2 p);
   void SetRepellerPoint(glm::dvec2 p);
   void DeselectAll();
   void SpawnSquare(glm::dvec2 pos);
   void SpawnRod(glm::dvec2 pos);
+  void SpawnSoftBody(glm::dvec2 pos);
+  void SpawnRigidBox(glm::dvec2 pos);
+  void SpawnCrate(glm::dvec2 pos);
   void EnableRepel();
   void DisableRepel();
+  // Reorders particles along a Morton curve every num_substeps substeps.
+  // 0, the default, never reorders.
+  void SetReorderInterval(int num_substeps);
+
+  //Region selection
+  void BeginRegionSelection(RegionMode mode, glm::dvec2 p);
+  void ExtendRegionSelection(glm::dvec2 p);
+  void EndRegionSelection();
+  bool IsSelectingRegion() const { return selecting_region_; }
+  std::vector<glm::dvec2> GetRegionOutline() const;
+
+  //Diagnostics
+  static constexpr int kFrameHistoryLength = 128;
+  void ToggleHud() { show_hud_ = !show_hud_; }
+  bool IsHudVisible() const { return show_hud_; }
+  const auto& GetFrameTimes() const { return frame_times_; }
+  int GetFrameCount() const { return frame_count_; }
+  int GetNumSubstepsLastFrame() const { return num_substeps_last_frame_; }
 
 private:
+  void Post(std::function<void()> command);
+  void RunCommands();
+  void Step(double dt);
+  void PublishSnapshot();
+  void PhysicsThreadLoop();
   void HandleFloorCollisions(double dt);
-  void SetRepellerForces();
+  void ReorderParticles();
+  void DragSelections(double dt);
   std::unique_ptr<Camera> camera_;
   std::vector<std::unique_ptr<pbd::PbdSystem>> pbds_;
-  std::map<std::pair<int,int>, Selection> selections_;
+  std::vector<std::unique_ptr<pbd::RigidBody>> rigid_bodies_;
+  std::vector<BodySelection> selections_;
+  bool dragging_ = false;
 
   glm::dvec2 attractor_point_;
   glm::dvec2 repeller_point_{0.0, 0.0};
-  bool repel_ = false;
+  int repeller_field_ = -1;
+  double repeller_strength_ = 50.0;
+  double repeller_radius_ = 0.5;
+  pbd::ForceFieldSet force_fields_;
   double floor_level_ = 0.0;
   double time_accumulator_ = 0.0;
   double point_radius_ = 0.01;
   double physics_dt_ = 0.01;
+  int reorder_interval_ = 0;
+  int64_t substep_count_ = 0;
   bool running_ = true;
   pbd::collisions::Collisions collisions_;
 
+  //Threading
+  TripleBuffer<RenderSnapshot> snapshots_;
+  std::thread physics_thread_;
+  std::atomic<bool> physics_thread_running_{false};
+  std::mutex command_mutex_;
+  std::vector<std::function<void()>> commands_;
+
+  //Region selection
+  bool selecting_region_ = false;
+  RegionMode region_mode_ = RegionMode::Box;
+  std::vector<glm::dvec2> region_points_;
+
+  //Diagnostics
+  bool show_hud_ = false;
+  std::array<double, kFrameHistoryLength> frame_times_{};
+  int frame_count_ = 0;
+  int num_substeps_last_frame_ = 0;
+  int64_t last_snapshot_step_count_ = 0;
+
   //Camera
   bool pan_left_ = false;
   bool pan_right_ = false;
@@ -0,0 +1,16 @@
+#ifndef SANDBOX_HUD_H_
+#define SANDBOX_HUD_H_
+
+#include <SDL2/SDL.h>
+
+namespace sandbox
+{
+
+class Sandbox;
+
+void RenderHud(const Sandbox& s, SDL_Window* window);
+void FreeHud();
+
+}
+
+#endif
@@ -1,9 +1,31 @@
+#ifndef SANDBOX_RENDER_H_
+#define SANDBOX_RENDER_H_
+
+#include "geometry.hpp"
 #include "sandbox.hpp"
 
 namespace sandbox
 {
 
+// Maps world coordinates to pixel coordinates for the current camera and
+// window size, so per-point conversions need no SDL or camera queries.
+struct ViewTransform
+{
+  glm::dvec2 center;
+  glm::dvec2 scale;
+  glm::dvec2 offset;
+  geometry::Rect visible;
+};
+
 void Render(const Sandbox& s, SDL_Window* window);
+void FreeRenderResources();
+
+ViewTransform GetViewTransform(const Sandbox& s, SDL_Window* window);
+
+inline glm::dvec2 WorldToPixel(const ViewTransform& v, glm::dvec2 coords)
+{
+  return v.offset + v.scale*(coords - v.center);
+}
 
 glm::ivec2 WorldToPixel(
     const Sandbox& s,
@@ -16,3 +38,5 @@ glm::dvec2 PixelToWorld(
     glm::ivec2 coords);
 
 }
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef SHAPE_MATCHING_H_
+#define SHAPE_MATCHING_H_
+
+#include "constraint_batch.hpp"
+#include "precision.hpp"
+
+#include <vector>
+
+namespace pbd
+{
+
+// Rigid pulls the particles towards the best rotated copy of the rest
+// shape. Plastic also lets the rest shape creep towards the current shape
+// wherever a particle strays further than the yield distance.
+enum class ShapeMatchingMode{Rigid, Plastic};
+
+// Meshless shape matching (Muller et al. 2005) over a group of particles.
+// Pinned members are never moved and anchor the fit of the others.
+struct ShapeMatchingConstraint
+{
+  std::vector<int> indices;
+  // Rest positions relative to the rest center of mass.
+  std::vector<Vec2> rest_offsets;
+  Real stiffness;
+  ShapeMatchingMode mode;
+  Real yield;
+  Real creep;
+
+  void Project(ConstraintContext& ctx);
+  void RemapIndices(const std::vector<int>& old_to_new);
+};
+
+// Takes the current positions of indices as the rest shape.
+ShapeMatchingConstraint MakeShapeMatchingConstraint(
+    const PointCloud& pc, std::vector<int> indices, Real stiffness,
+    ShapeMatchingMode mode = ShapeMatchingMode::Rigid,
+    Real yield = 0, Real creep = 0);
+
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef SPATIAL_GRID_H_
+#define SPATIAL_GRID_H_
+
+#include "precision.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace pbd
+{
+
+// Uniform grid stored as entries sorted by cell. Cells of a row are
+// contiguous, so a box query costs one binary search per row.
+class SpatialGrid
+{
+public:
+  explicit SpatialGrid(Real cell_size);
+  void SetCellSize(Real cell_size);
+  Real GetCellSize() const { return cell_size_; }
+  void Clear();
+  void Insert(Vec2 p, int id);
+  // Must be called after inserting and before querying.
+  void Build();
+  int GetNumEntries() const { return entries_.size(); }
+
+  // Calls f(id) for every entry in a cell overlapping the box [lo, hi].
+  template <typename F>
+  void Query(Vec2 lo, Vec2 hi, F&& f) const;
+
+  template <typename F>
+  void QueryRadius(Vec2 center, Real radius, F&& f) const
+  {
+    Query(center - Vec2{radius, radius},
+          center + Vec2{radius, radius}, f);
+  }
+
+private:
+  struct Entry
+  {
+    uint64_t key;
+    int id;
+  };
+
+  glm::ivec2 GetCell(Vec2 p) const;
+  static uint64_t GetKey(int x, int y);
+
+  Real cell_size_;
+  std::vector<Entry> entries_;
+};
+
+inline glm::ivec2 SpatialGrid::GetCell(Vec2 p) const
+{
+  return {static_cast<int>(glm::floor(p.x/cell_size_)),
+          static_cast<int>(glm::floor(p.y/cell_size_))};
+}
+
+inline uint64_t SpatialGrid::GetKey(int x, int y)
+{
+  // Flipping the sign bit keeps negative cells ordered before positive ones.
+  const uint64_t ux = static_cast<uint32_t>(x) ^ 0x80000000u;
+  const uint64_t uy = static_cast<uint32_t>(y) ^ 0x80000000u;
+  return (uy << 32) | ux;
+}
+
+template <typename F>
+void SpatialGrid::Query(Vec2 lo, Vec2 hi, F&& f) const
+{
+  const auto c0 = GetCell(lo);
+  const auto c1 = GetCell(hi);
+  const auto by_key = [](const Entry& e, uint64_t key) { return e.key < key; };
+
+  for (int y = c0.y; y <= c1.y; ++y)
+  {
+    const auto last_key = GetKey(c1.x, y);
+    auto it = std::lower_bound(
+        entries_.begin(), entries_.end(), GetKey(c0.x, y), by_key);
+    for (; it != entries_.end() && it->key <= last_key; ++it)
+    {
+      f(it->id);
+    }
+  }
+}
+
+}
+
+#endif
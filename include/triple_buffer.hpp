@@ -0,0 +1,47 @@
+#ifndef TRIPLE_BUFFER_H_
+#define TRIPLE_BUFFER_H_
+
+#include <array>
+#include <atomic>
+
+namespace sandbox
+{
+
+// Lock-free single producer, single consumer triple buffer. The producer
+// fills GetWriteBuffer() and publishes it; the consumer picks up the most
+// recently published buffer without ever blocking the producer.
+template <typename T>
+class TripleBuffer
+{
+public:
+  T& GetWriteBuffer() { return buffers_[write_]; }
+
+  void Publish()
+  {
+    write_ = middle_.exchange(write_ | kFresh, std::memory_order_acq_rel)
+             & kIndexMask;
+  }
+
+  // Returns true if a newer buffer was published since the last call.
+  bool Acquire()
+  {
+    if (!(middle_.load(std::memory_order_relaxed) & kFresh))
+      return false;
+    read_ = middle_.exchange(read_, std::memory_order_acq_rel) & kIndexMask;
+    return true;
+  }
+
+  const T& GetReadBuffer() const { return buffers_[read_]; }
+
+private:
+  static constexpr int kIndexMask = 3;
+  static constexpr int kFresh = 4;
+  std::array<T, 3> buffers_;
+  int write_ = 0;
+  int read_ = 1;
+  std::atomic<int> middle_{2};
+};
+
+}
+
+#endif
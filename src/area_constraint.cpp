@@ -0,0 +1,65 @@
+#include "area_constraint.hpp"
+
+#include <glm/gtx/norm.hpp>
+
+namespace pbd
+{
+
+Real GetPolygonArea(const PointCloud& pc, const std::vector<int>& indices)
+{
+  const int n = indices.size();
+  Real area = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    const auto p = pc.GetPoint(indices[i]);
+    const auto q = pc.GetPoint(indices[(i+1)%n]);
+    area += p.x*q.y - q.x*p.y;
+  }
+  return area/2;
+}
+
+void AreaConstraint::Project(ConstraintContext& ctx) const
+{
+  const int n = indices.size();
+  if (n < 3)
+    return;
+
+  const auto C = GetPolygonArea(*ctx.pc, indices) - pressure*rest_area;
+
+  // dA/dx_i = 1/2 (y_i+1 - y_i-1, x_i-1 - x_i+1)
+  Real w = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    const auto prev = ctx.GetPoint(indices[(i+n-1)%n]);
+    const auto next = ctx.GetPoint(indices[(i+1)%n]);
+    const Vec2 grad = Vec2{next.y - prev.y, prev.x - next.x}/Real(2);
+    w += glm::length2(grad)/ctx.GetMass(indices[i]);
+  }
+  if (w == 0)
+    return;
+
+  const auto s = C/w*stiffness;
+  // Gradients must use the positions before this projection, so walk the
+  // outline keeping the original neighbours of the current vertex.
+  const auto first = ctx.GetPoint(indices[0]);
+  auto prev = ctx.GetPoint(indices[n-1]);
+  auto current = first;
+  for (int i = 0; i < n; ++i)
+  {
+    const auto next = i+1 < n ? ctx.GetPoint(indices[i+1]) : first;
+    const Vec2 grad = Vec2{next.y - prev.y, prev.x - next.x}/Real(2);
+    ctx.Displace(indices[i], -s/ctx.GetMass(indices[i])*grad);
+    prev = current;
+    current = next;
+  }
+}
+
+void AreaConstraint::RemapIndices(const std::vector<int>& old_to_new)
+{
+  for (auto& idx : indices)
+  {
+    idx = old_to_new[idx];
+  }
+}
+
+}
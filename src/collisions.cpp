@@ -2,24 +2,87 @@
 
 #include "point_cloud.hpp"
 #include "geometry.hpp"
+#include "profiler.hpp"
 
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
 namespace pbd
 {
 namespace collisions
 {
 
+namespace
+{
+
+bool CollidesWithNothing(const CollisionFilter& f)
+{
+  return f.group <= 0 && (f.category == 0 || f.mask == 0);
+}
+
+// Finds the pairs i < j of overlapping boxes by sorting them along x and
+// sweeping, and returns them in ascending order.
+void FindOverlappingPairs(const std::vector<geometry::Rect>& boxes,
+    std::vector<int>* order, std::vector<std::pair<int, int>>* pairs)
+{
+  const int n = boxes.size();
+  order->resize(n);
+  for (int i = 0; i < n; ++i)
+    (*order)[i] = i;
+  std::sort(order->begin(), order->end(), [&](int a, int b)
+      {
+        return boxes[a].x1 < boxes[b].x1;
+      });
+
+  pairs->clear();
+  for (int k = 0; k < n; ++k)
+  {
+    const int i = (*order)[k];
+    for (int l = k+1; l < n; ++l)
+    {
+      const int j = (*order)[l];
+      if (boxes[j].x1 > boxes[i].x2)
+        break;
+      if (geometry::RectsOverlap(boxes[i], boxes[j]))
+        pairs->push_back({std::min(i, j), std::max(i, j)});
+    }
+  }
+  std::sort(pairs->begin(), pairs->end());
+}
+
+// Shares of a correction taken by a particle and by a segment whose ends
+// move together, by inverse mass. Pinned particles have infinite mass and
+// take no share. Returns false if neither side can move.
+bool GetContactWeights(Real pmass, Real q1mass, Real q2mass,
+    Real* pw, Real* qw)
+{
+  const Real wp = 1/pmass;
+  const Real wq = 1/(q1mass+q2mass);
+  const Real w = wp+wq;
+  if (w == 0)
+    return false;
+  *pw = wp/w;
+  *qw = wq/w;
+  return true;
+}
+
+}
+
 void Collisions::AddPointCloud(PointCloud* pc)
 {
   point_clouds_.push_back(pc);
+  broadphase_dirty_ = true;
 }
 
 void Collisions::AddRod(PointCloud *pc)
 {
   for (int i = 0; i < pc->GetNumPoints()-1; ++i)
   {
-    const double friction_coefficient = 0.0;
+    const Real friction_coefficient = 0.0;
     AddLineSeg(pc, i, i+1, friction_coefficient);
   }
   for (int i = 0; i < pc->GetNumPoints(); ++i)
@@ -29,183 +92,1360 @@ void Collisions::AddRod(PointCloud *pc)
 }
 
 void Collisions::AddHalfPlane(
-    glm::dvec2 normal, glm::dvec2 center, double friction_coefficient)
+    Vec2 normal, Vec2 center, Real friction_coefficient,
+    const CollisionFilter& filter)
 {
-  friction_coefficient = glm::clamp(friction_coefficient, 0.0, 1.0);
-  half_planes_.push_back({normal, center, friction_coefficient});
+  friction_coefficient = glm::clamp(friction_coefficient, Real(0), Real(1));
+  half_planes_.push_back({normal, center, friction_coefficient, filter});
 }
 
 void Collisions::AddLineSeg(PointCloud* pc, int idx1, int idx2,
-    double friction_coefficient)
+    Real friction_coefficient)
 {
   line_segs_.push_back({pc, idx1, idx2, friction_coefficient});
+  filters_dirty_ = true;
+  contact_particles_dirty_ = true;
+  for (auto& sc : self_colliders_)
+  {
+    if (sc.pc == pc)
+      sc.topology_dirty = true;
+  }
 }
 
 void Collisions::AddPoint(PointCloud* pc, int idx)
 {
   points_.push_back({pc, idx});
+  filters_dirty_ = true;
+  contact_particles_dirty_ = true;
+  for (auto& sc : self_colliders_)
+  {
+    if (sc.pc == pc)
+      sc.topology_dirty = true;
+  }
 }
 
-void Collisions::ResolveCollisions(double dt)
+void Collisions::ResolveCollisions(Real dt)
 {
+  stats_ = {};
+  UpdateFilters();
+  ++num_resolves_;
+  // Particles moved since the last call, so the shared grid is rebuilt
+  // once here and reused by queries until the next call.
+  broadphase_dirty_ = true;
+  UpdateBroadphase();
   ResolveAllPointLineSegCollisions(dt);
+  ResolveAllSelfCollisions(dt);
   ResolveAllHalfPlaneCollisions(dt);
   ResolveAllPolygonPointCollisions(dt);
+  ResolveAllPolygonPolygonCollisions(dt);
+  ResolveAllRigidBodyCollisions(dt);
+}
+
+void Collisions::SetCollisionFilter(
+    PointCloud* pc, const CollisionFilter& filter)
+{
+  auto& f = body_filters_[pc];
+  f.body = filter;
+  f.particles.clear();
+  filters_dirty_ = true;
+  broadphase_dirty_ = true;
+}
+
+void Collisions::SetCollisionFilter(
+    PointCloud* pc, int idx, const CollisionFilter& filter)
+{
+  auto& f = body_filters_[pc];
+  if (idx >= static_cast<int>(f.particles.size()))
+    f.particles.resize(idx+1, f.body);
+  f.particles[idx] = filter;
+  filters_dirty_ = true;
+  broadphase_dirty_ = true;
+}
+
+void Collisions::SetCollisionFilter(
+    RigidBody* body, const CollisionFilter& filter)
+{
+  for (int i = 0; i < static_cast<int>(rigid_bodies_.size()); ++i)
+  {
+    if (rigid_bodies_[i] == body)
+      rigid_body_filters_[i] = filter;
+  }
+}
+
+const CollisionFilter& Collisions::GetFilter(
+    const PointCloud* pc, int idx) const
+{
+  static const CollisionFilter kDefault;
+  const auto it = body_filters_.find(pc);
+  if (it == body_filters_.end())
+    return kDefault;
+  const auto& f = it->second;
+  return idx < static_cast<int>(f.particles.size()) ? f.particles[idx]
+                                                    : f.body;
+}
+
+void Collisions::UpdateFilters()
+{
+  if (!filters_dirty_)
+    return;
+
+  point_filters_.clear();
+  for (const auto& pt : points_)
+    point_filters_.push_back(GetFilter(pt.pc, pt.idx));
+  line_seg_filters_.clear();
+  for (const auto& l : line_segs_)
+    line_seg_filters_.push_back(GetFilter(l.pc, l.idx1));
+  polygon_filters_.clear();
+  for (const auto& poly : polygons_)
+  {
+    const auto it = body_filters_.find(poly.pc);
+    polygon_filters_.push_back(
+        it == body_filters_.end() ? CollisionFilter{} : it->second.body);
+  }
+  filters_dirty_ = false;
+}
+
+void Collisions::SetBroadphaseCellSize(Real cell_size)
+{
+  point_grid_.SetCellSize(cell_size);
+  broadphase_dirty_ = true;
+}
+
+void Collisions::UpdateBroadphase()
+{
+  if (!broadphase_dirty_)
+    return;
+
+  point_grid_.Clear();
+  grid_points_.clear();
+  grid_filters_.clear();
+  grid_registered_.clear();
+  grid_cloud_offsets_.clear();
+  grid_max_radius_ = 0.0;
+  for (const auto& pc : point_clouds_)
+  {
+    grid_cloud_offsets_.emplace(pc, grid_points_.size());
+    for (int i = 0; i < pc->GetNumPoints(); ++i)
+    {
+      point_grid_.Insert(pc->GetPoint(i), grid_points_.size());
+      grid_points_.push_back({pc, i});
+      grid_filters_.push_back(GetFilter(pc, i));
+      grid_registered_.push_back(-1);
+      grid_max_radius_ = std::max(grid_max_radius_, pc->GetRadius(i));
+    }
+  }
+  grid_num_cloud_entries_ = grid_points_.size();
+
+  // Registered points share the entry of their particle. Points of bodies
+  // that were not added, or registered twice, get entries of their own
+  // past the particles of the point clouds.
+  grid_point_pad_ = 0.0;
+  for (int k = 0; k < static_cast<int>(points_.size()); ++k)
+  {
+    const auto& pt = points_[k];
+    const auto p = pt.pc->GetPoint(pt.idx);
+    const auto step = p - pt.pc->GetPointFromPreviousTimestep(pt.idx);
+    grid_point_pad_ = std::max(grid_point_pad_,
+        pt.pc->GetRadius(pt.idx) + glm::length(step));
+
+    const auto offset = grid_cloud_offsets_.find(pt.pc);
+    if (offset != grid_cloud_offsets_.end() &&
+        grid_registered_[offset->second + pt.idx] < 0)
+    {
+      grid_registered_[offset->second + pt.idx] = k;
+      continue;
+    }
+    point_grid_.Insert(p, grid_points_.size());
+    grid_points_.push_back(pt);
+    grid_filters_.push_back(GetFilter(pt.pc, pt.idx));
+    grid_registered_.push_back(k);
+  }
+  point_grid_.Build();
+  broadphase_dirty_ = false;
 }
 
-void Collisions::ResolveAllHalfPlaneCollisions(double dt)
+bool Collisions::FindNearestPoint(Vec2 p, Real radius, Point* nearest)
 {
+  bool found = false;
+  Real smallest_dist2 = radius*radius;
+  const auto visit = [&](const Point& pt)
+  {
+    const auto d = pt.pc->GetPoint(pt.idx) - p;
+    const auto dist2 = glm::dot(d, d);
+    if (dist2 <= smallest_dist2)
+    {
+      smallest_dist2 = dist2;
+      *nearest = pt;
+      found = true;
+    }
+  };
+
+  // A single pick is cheaper to scan for than a grid rebuild, which the
+  // next ResolveCollisions call would redo anyway.
+  if (broadphase_dirty_)
+  {
+    for (const auto& pc : point_clouds_)
+    {
+      for (int i = 0; i < pc->GetNumPoints(); ++i)
+        visit({pc, i});
+    }
+  }
+  else
+  {
+    ForEachPointInRadius(p, radius, visit);
+  }
+
+  return found;
+}
+
+void Collisions::RemapPointCloud(
+    PointCloud* pc, const std::vector<int>& old_to_new)
+{
+  broadphase_dirty_ = true;
+  filters_dirty_ = true;
+  contact_particles_dirty_ = true;
+
+  for (auto& sc : self_colliders_)
+  {
+    if (sc.pc == pc)
+      sc.topology_dirty = true;
+  }
+
+  auto filter = body_filters_.find(pc);
+  if (filter != body_filters_.end() && !filter->second.particles.empty())
+  {
+    auto& particles = filter->second.particles;
+    std::vector<CollisionFilter> remapped(
+        old_to_new.size(), filter->second.body);
+    for (int i = 0; i < static_cast<int>(particles.size()); ++i)
+      remapped[old_to_new[i]] = particles[i];
+    particles.swap(remapped);
+  }
+
+  for (auto& l : line_segs_)
+  {
+    if (l.pc != pc)
+      continue;
+    l.idx1 = old_to_new[l.idx1];
+    l.idx2 = old_to_new[l.idx2];
+  }
+
+  for (auto& pt : points_)
+  {
+    if (pt.pc == pc)
+      pt.idx = old_to_new[pt.idx];
+  }
+
+  for (auto& poly : polygons_)
+  {
+    for (auto& l : poly.line_segments)
+    {
+      if (l.pc != pc)
+        continue;
+      l.idx1 = old_to_new[l.idx1];
+      l.idx2 = old_to_new[l.idx2];
+    }
+  }
+}
+
+void Collisions::ResolveAllHalfPlaneCollisions(Real dt)
+{
+  PBD_PROFILE_SCOPE(timer, HalfPlaneCollisions);
+  PBD_PROFILE_TESTED(timer, half_planes_.size()*point_clouds_.size());
   for (const auto& hp : half_planes_)
   {
     for (const auto& pc : point_clouds_)
     {
-      ResolveHalfPlaneCollisions(pc, hp, dt);
+      const auto filter = body_filters_.find(pc);
+      int n = 0;
+      if (filter == body_filters_.end() ||
+          filter->second.particles.empty())
+      {
+        if (filter != body_filters_.end() &&
+            !ShouldCollide(filter->second.body, hp.filter))
+        {
+          continue;
+        }
+        n = ResolveHalfPlaneCollisions(pc, hp, dt, &stats_.max_penetration);
+      }
+      else
+      {
+        for (int i = 0; i < pc->GetNumPoints(); ++i)
+        {
+          if (ShouldCollide(GetFilter(pc, i), hp.filter) &&
+              ResolveHalfPlaneCollision(
+                  pc, i, hp, dt, &stats_.max_penetration))
+          {
+            n += 1;
+          }
+        }
+      }
+      PBD_PROFILE_HITS(timer, n);
+      stats_.num_contacts += n;
     }
   }
 }
 
-void Collisions::ResolveAllPointLineSegCollisions(double dt)
+void Collisions::UpdateContactParticles()
 {
-  for (const auto& pt : points_)
+  if (contact_particles_dirty_)
   {
+    contact_particles_.clear();
+    std::unordered_map<const PointCloud*, std::vector<int>> ids;
+    const auto get_id = [&](PointCloud* pc, int idx)
+    {
+      auto& pc_ids = ids[pc];
+      if (pc_ids.empty())
+        pc_ids.assign(pc->GetNumPoints(), -1);
+      if (pc_ids[idx] < 0)
+      {
+        pc_ids[idx] = contact_particles_.size();
+        contact_particles_.push_back({pc, idx});
+      }
+      return pc_ids[idx];
+    };
+    point_particles_.clear();
+    for (const auto& pt : points_)
+      point_particles_.push_back(get_id(pt.pc, pt.idx));
+    line_seg_particles_.clear();
     for (const auto& l : line_segs_)
+      line_seg_particles_.push_back(
+          {get_id(l.pc, l.idx1), get_id(l.pc, l.idx2)});
+
+    const int n = contact_particles_.size();
+    contact_particle_positions_.resize(n);
+    for (int i = 0; i < n; ++i)
     {
-      if (pt.pc == l.pc)
-        continue;
+      const auto& pt = contact_particles_[i];
+      contact_particle_positions_[i] = pt.pc->GetPoint(pt.idx);
+    }
+    contact_particle_corrected_.assign(n, -1);
+    separations_.clear();
+    contact_particles_dirty_ = false;
+  }
 
-      const auto p = pt.pc->GetPoint(pt.idx);
-      const auto q1 = l.pc->GetPoint(l.idx1);
-      const auto q2 = l.pc->GetPoint(l.idx2);
-      const auto d = geometry::PointLinesegDistance(p,q1,q2);
-      const auto r = pt.pc->GetRadius(pt.idx);
+  // Every position a particle took over the step, and so the path checked
+  // for tunneling, lies within its travel of its last position.
+  const int n = contact_particles_.size();
+  contact_particle_travel_.resize(n);
+  for (int i = 0; i < n; ++i)
+  {
+    const auto& pt = contact_particles_[i];
+    const auto p = pt.pc->GetPoint(pt.idx);
+    const auto p_old = pt.pc->GetPointFromPreviousTimestep(pt.idx);
+    const auto& last = contact_particle_positions_[i];
+    contact_particle_travel_[i] =
+      std::max(glm::length(p - last), glm::length(p_old - last));
+    contact_particle_positions_[i] = p;
+  }
+}
 
-      if (glm::abs(d-r) < 0.01*r)
-        continue;
+void Collisions::ResolveAllPointLineSegCollisions(Real dt)
+{
+  PBD_PROFILE_SCOPE(timer, PointLineSegCollisions);
+  UpdateContactParticles();
+  if (points_.empty() || line_segs_.empty())
+    return;
 
-      if (d < r)
+  // Each segment queries the shared grid with its box, padded by the
+  // largest radius and step displacement of a registered point so that
+  // tunneling points are found too. The pairs are then resolved point by
+  // point, in registration order.
+  const auto pad = grid_point_pad_;
+  point_line_seg_pairs_.clear();
+  for (int j = 0; j < static_cast<int>(line_segs_.size()); ++j)
+  {
+    const auto& l = line_segs_[j];
+    const auto& filter = line_seg_filters_[j];
+    if (CollidesWithNothing(filter))
+      continue;
+    const auto q1 = l.pc->GetPoint(l.idx1);
+    const auto q2 = l.pc->GetPoint(l.idx2);
+    const Vec2 lo = glm::min(q1, q2) - Vec2{pad, pad};
+    const Vec2 hi = glm::max(q1, q2) + Vec2{pad, pad};
+    point_grid_.Query(lo, hi, [&](int id)
+    {
+      const auto i = grid_registered_[id];
+      if (i < 0 || points_[i].pc == l.pc ||
+          !ShouldCollide(point_filters_[i], filter))
+      {
+        return;
+      }
+      point_line_seg_pairs_.push_back({i, j});
+    });
+  }
+  std::sort(point_line_seg_pairs_.begin(), point_line_seg_pairs_.end());
+
+  // A pair that was apart when last measured is skipped, tunneling test
+  // included, while its distance less the travel of its particles stays
+  // above the radius. Particles corrected earlier in this pass have moved
+  // by an unknown amount, so their pairs are measured again.
+  const auto& travel = contact_particle_travel_;
+  next_separations_.clear();
+  auto last = separations_.begin();
+  for (const auto& [i, j] : point_line_seg_pairs_)
+  {
+    while (last != separations_.end() &&
+           (last->point < i || (last->point == i && last->line_seg < j)))
+    {
+      ++last;
+    }
+    const auto sp = point_particles_[i];
+    const auto [s1, s2] = line_seg_particles_[j];
+    const auto corrected =
+      contact_particle_corrected_[sp] == num_resolves_ ||
+      contact_particle_corrected_[s1] == num_resolves_ ||
+      contact_particle_corrected_[s2] == num_resolves_;
+    const auto r = points_[i].pc->GetRadius(points_[i].idx);
+    if (!corrected && last != separations_.end() &&
+        last->point == i && last->line_seg == j)
+    {
+      const auto distance =
+        last->distance - travel[sp] - std::max(travel[s1], travel[s2]);
+      if (distance > r)
       {
-        const auto pmass = pt.pc->GetMass(pt.idx);
-        const auto q1mass = l.pc->GetMass(l.idx1);
-        const auto q2mass = l.pc->GetMass(l.idx2);
-        const glm::dvec2 tangent = glm::normalize(q2-q1);
-        const glm::dvec2 proj = glm::dot(p-q1,tangent)*tangent;
-        const glm::dvec2 dir = glm::normalize(p-q1-proj);
-        const double total_mass = pmass+q1mass+q2mass;
-        const double pw = pmass/total_mass;
-        const double qw = (q1mass+q2mass)/total_mass;
-        const double len = r-d;
-        const auto dp = pw*len*dir;
-        const auto dq1 = -qw*len*dir;
-        const auto dq2 = -qw*len*dir;
-        pt.pc->DisplacePointAndUpdateVelocity(pt.idx, dp, dt);
-        l.pc->DisplacePointAndUpdateVelocity(l.idx1, dq1, dt);
-        l.pc->DisplacePointAndUpdateVelocity(l.idx2, dq2, dt);
-
-        const glm::dvec2 new_vel{
-          l.friction_coefficient, l.friction_coefficient};
-        pt.pc->SetVelocity(pt.idx, new_vel);
-        l.pc->SetVelocity(l.idx1, new_vel);
-        l.pc->SetVelocity(l.idx2, new_vel);
+        next_separations_.push_back({i, j, distance});
         continue;
       }
+    }
 
-      const auto p_old = pt.pc->GetPointFromPreviousTimestep(pt.idx);
-      glm::dvec2 intersec;
-      const auto tunneled = geometry::LinesegLinesegIntersection(
-          p_old, p, q1, q2, &intersec);
+    PBD_PROFILE_TESTED(timer, 1);
+    Real penetration;
+    Real distance = 0.0;
+    if (ResolvePointLineSegPair(i, j, dt, &penetration, &distance))
+    {
+      PBD_PROFILE_HITS(timer, 1);
+      stats_.num_contacts += 1;
+      stats_.max_penetration =
+        std::max(stats_.max_penetration, penetration);
+    }
+    else if (!corrected && distance > r)
+    {
+      next_separations_.push_back({i, j, distance});
+    }
+  }
+  separations_.swap(next_separations_);
+}
+
+bool Collisions::ResolvePointLineSegPair(
+    int point, int line_seg, Real dt, Real* penetration, Real* distance)
+{
+  const auto& pt = points_[point];
+  const auto& l = line_segs_[line_seg];
+  const auto p = pt.pc->GetPoint(pt.idx);
+  const auto q1 = l.pc->GetPoint(l.idx1);
+  const auto q2 = l.pc->GetPoint(l.idx2);
+  const auto d = geometry::PointLinesegDistance(p,q1,q2);
+  const auto r = pt.pc->GetRadius(pt.idx);
 
-      if (tunneled)
+  Real pw, qw;
+  if (!GetContactWeights(pt.pc->GetMass(pt.idx),
+        l.pc->GetMass(l.idx1), l.pc->GetMass(l.idx2), &pw, &qw))
+  {
+    return false;
+  }
+
+  if (distance)
+    *distance = d;
+  if (glm::abs(d-r) < Real(0.01)*r)
+    return false;
+
+  const auto sp = point_particles_[point];
+  const auto [s1, s2] = line_seg_particles_[line_seg];
+  if (d < r)
+  {
+    *penetration = r-d;
+    const Vec2 tangent = glm::normalize(q2-q1);
+    const Vec2 proj = glm::dot(p-q1,tangent)*tangent;
+    const Vec2 dir = glm::normalize(p-q1-proj);
+    const Real len = r-d;
+    const auto dp = pw*len*dir;
+    const auto dq1 = -qw*len*dir;
+    const auto dq2 = -qw*len*dir;
+    pt.pc->DisplacePointAndUpdateVelocity(pt.idx, dp, dt);
+    l.pc->DisplacePointAndUpdateVelocity(l.idx1, dq1, dt);
+    l.pc->DisplacePointAndUpdateVelocity(l.idx2, dq2, dt);
+
+    const Vec2 new_vel{
+      l.friction_coefficient, l.friction_coefficient};
+    pt.pc->SetVelocity(pt.idx, new_vel);
+    l.pc->SetVelocity(l.idx1, new_vel);
+    l.pc->SetVelocity(l.idx2, new_vel);
+    contact_particle_corrected_[sp] = num_resolves_;
+    contact_particle_corrected_[s1] = num_resolves_;
+    contact_particle_corrected_[s2] = num_resolves_;
+    return true;
+  }
+
+  const auto p_old = pt.pc->GetPointFromPreviousTimestep(pt.idx);
+  Vec2 intersec;
+  const auto tunneled = geometry::LinesegLinesegIntersection(
+      p_old, p, q1, q2, &intersec);
+
+  if (tunneled)
+  {
+    *penetration = 0.0;
+    pt.pc->DisplacePointAndUpdateVelocity(
+        pt.idx, Real(2)*(intersec-p), dt);
+    contact_particle_corrected_[sp] = num_resolves_;
+    return true;
+  }
+  return false;
+}
+
+void Collisions::EnableSelfCollision(PointCloud* pc, int num_excluded_hops)
+{
+  for (auto& sc : self_colliders_)
+  {
+    if (sc.pc == pc)
+    {
+      sc.num_excluded_hops = num_excluded_hops;
+      sc.topology_dirty = true;
+      return;
+    }
+  }
+  SelfCollider sc;
+  sc.pc = pc;
+  sc.num_excluded_hops = num_excluded_hops;
+  self_colliders_.push_back(std::move(sc));
+}
+
+void Collisions::UpdateSelfCollisionTopology(SelfCollider* sc)
+{
+  sc->points.clear();
+  for (int i = 0; i < static_cast<int>(points_.size()); ++i)
+  {
+    if (points_[i].pc == sc->pc)
+      sc->points.push_back(i);
+  }
+  sc->segments.clear();
+  for (int i = 0; i < static_cast<int>(line_segs_.size()); ++i)
+  {
+    if (line_segs_[i].pc == sc->pc)
+      sc->segments.push_back(i);
+  }
+
+  const int num_points = sc->pc->GetNumPoints();
+  std::vector<std::vector<int>> adjacent(num_points);
+  for (const auto j : sc->segments)
+  {
+    const auto& l = line_segs_[j];
+    adjacent[l.idx1].push_back(l.idx2);
+    adjacent[l.idx2].push_back(l.idx1);
+  }
+
+  // Breadth-first search from every particle, num_excluded_hops deep.
+  sc->neighbor_offsets.assign(num_points+1, 0);
+  sc->neighbors.clear();
+  std::vector<int> visited(num_points, -1);
+  std::vector<int> frontier;
+  std::vector<int> next;
+  for (int i = 0; i < num_points; ++i)
+  {
+    const auto begin = sc->neighbors.size();
+    visited[i] = i;
+    sc->neighbors.push_back(i);
+    frontier.assign(1, i);
+    for (int hop = 0; hop < sc->num_excluded_hops; ++hop)
+    {
+      next.clear();
+      for (const auto k : frontier)
       {
-        pt.pc->DisplacePointAndUpdateVelocity(
-            pt.idx, 2.0*(intersec-p), dt);
+        for (const auto m : adjacent[k])
+        {
+          if (visited[m] == i)
+            continue;
+          visited[m] = i;
+          sc->neighbors.push_back(m);
+          next.push_back(m);
+        }
       }
+      frontier.swap(next);
     }
+    std::sort(sc->neighbors.begin() + begin, sc->neighbors.end());
+    sc->neighbor_offsets[i+1] = sc->neighbors.size();
   }
+  sc->topology_dirty = false;
 }
 
-void Collisions::ResolveAllPolygonPointCollisions(double dt)
+void Collisions::ResolveAllSelfCollisions(Real dt)
 {
-  for (const auto& poly : polygons_)
+  PBD_PROFILE_SCOPE(timer, SelfCollisions);
+  for (auto& sc : self_colliders_)
   {
-    for (const auto& point : points_)
+    if (sc.topology_dirty)
+      UpdateSelfCollisionTopology(&sc);
+    if (sc.segments.empty())
+      continue;
+
+    // The grid holds the body's points and is queried with each segment.
+    // Queries are padded by the largest radius and step displacement so
+    // that tunneling points are found as well.
+    Real max_length = 0.0;
+    for (const auto j : sc.segments)
     {
-      if (poly.pc == point.pc)
+      const auto& l = line_segs_[j];
+      max_length = std::max(max_length,
+          glm::length(sc.pc->GetPoint(l.idx2) - sc.pc->GetPoint(l.idx1)));
+    }
+    Real pad = 0.0;
+    for (const auto i : sc.points)
+    {
+      const auto& pt = points_[i];
+      const auto step = sc.pc->GetPoint(pt.idx) -
+                        sc.pc->GetPointFromPreviousTimestep(pt.idx);
+      pad = std::max(pad, sc.pc->GetRadius(pt.idx) + glm::length(step));
+    }
+    if (max_length > 0)
+      sc.grid.SetCellSize(max_length);
+    sc.grid.Clear();
+    for (int k = 0; k < static_cast<int>(sc.points.size()); ++k)
+    {
+      sc.grid.Insert(sc.pc->GetPoint(points_[sc.points[k]].idx), k);
+    }
+    sc.grid.Build();
+
+    for (const auto j : sc.segments)
+    {
+      const auto& l = line_segs_[j];
+      const auto q1 = sc.pc->GetPoint(l.idx1);
+      const auto q2 = sc.pc->GetPoint(l.idx2);
+      const Vec2 lo = glm::min(q1, q2) - Vec2{pad, pad};
+      const Vec2 hi = glm::max(q1, q2) + Vec2{pad, pad};
+      sc.grid.Query(lo, hi, [&](int k)
       {
+        const auto& pt = points_[sc.points[k]];
+        const auto first = sc.neighbors.begin() + sc.neighbor_offsets[pt.idx];
+        const auto last = sc.neighbors.begin() + sc.neighbor_offsets[pt.idx+1];
+        if (std::binary_search(first, last, l.idx1) ||
+            std::binary_search(first, last, l.idx2) ||
+            !ShouldCollide(point_filters_[sc.points[k]], line_seg_filters_[j]))
+        {
+          return;
+        }
+        PBD_PROFILE_TESTED(timer, 1);
+        Real penetration;
+        if (ResolvePointLineSegPair(sc.points[k], j, dt, &penetration))
+        {
+          PBD_PROFILE_HITS(timer, 1);
+          stats_.num_contacts += 1;
+          stats_.max_penetration =
+            std::max(stats_.max_penetration, penetration);
+        }
+      });
+    }
+  }
+}
+
+void Collisions::ResolveAllPolygonPointCollisions(Real dt)
+{
+  PBD_PROFILE_SCOPE(timer, PolygonPointCollisions);
+  // Earlier passes may have moved particles since the grid was built.
+  const auto pad = point_grid_.GetCellSize();
+  for (int i = 0; i < static_cast<int>(polygons_.size()); ++i)
+  {
+    const auto& poly = polygons_[i];
+    const auto& filter = polygon_filters_[i];
+    if (CollidesWithNothing(filter))
+      continue;
+
+    const auto box = poly.pc->GetBoundingBox();
+    polygon_point_candidates_.clear();
+    point_grid_.Query(Vec2{box.x1-pad, box.y1-pad},
+                      Vec2{box.x2+pad, box.y2+pad}, [&](int id)
+    {
+      const auto j = grid_registered_[id];
+      if (j < 0 || points_[j].pc == poly.pc ||
+          !ShouldCollide(filter, point_filters_[j]))
+      {
+        return;
+      }
+      polygon_point_candidates_.push_back(j);
+    });
+    std::sort(polygon_point_candidates_.begin(),
+              polygon_point_candidates_.end());
+    PBD_PROFILE_TESTED(timer, polygon_point_candidates_.size());
+
+    for (const auto j : polygon_point_candidates_)
+    {
+      Real penetration;
+      if (ResolvePolygonPointCollision(poly, points_[j], dt, &penetration))
+      {
+        PBD_PROFILE_HITS(timer, 1);
+        stats_.num_contacts += 1;
+        stats_.max_penetration =
+          std::max(stats_.max_penetration, penetration);
+      }
+    }
+  }
+}
+
+void Collisions::AddRigidBody(RigidBody* body)
+{
+  rigid_bodies_.push_back(body);
+  rigid_body_filters_.emplace_back();
+}
+
+namespace
+{
+
+// Vertices this close to another body are kept as contacts. They only get
+// an impulse when the other contacts of the pair push them in.
+const Real kRigidContactMargin = 0.002;
+
+// Contacts whose normal is within 45 degrees of gravity support a body.
+const Real kSupportCosine = 0.7071;
+
+Vec2 GetFaceNormal(const std::vector<Vec2>& polygon, int face)
+{
+  const auto e = polygon[(face+1)%polygon.size()] - polygon[face];
+  return glm::normalize(Vec2{e.y, -e.x});
+}
+
+// Largest signed distance of p from the faces of a convex polygon, negative
+// inside.
+Real GetPointSeparation(const std::vector<Vec2>& polygon, Vec2 p)
+{
+  Real separation = -std::numeric_limits<Real>::max();
+  for (int i = 0; i < polygon.size(); ++i)
+  {
+    separation = std::max(
+        separation, glm::dot(p - polygon[i], GetFaceNormal(polygon, i)));
+  }
+  return separation;
+}
+
+// Displacement along u at p per unit impulse along v at q.
+Real GetCoupling(const RigidBody* body, Vec2 p, Vec2 u, Vec2 q, Vec2 v)
+{
+  const auto c = body->GetPosition();
+  return body->GetInverseMass()*glm::dot(u, v) + geometry::Cross(p - c, u)*
+      geometry::Cross(q - c, v)*body->GetInverseInertia();
+}
+
+// Resolves the penetration of the contacts between a and b (null for static
+// geometry) along n and removes their tangential slip since the previous
+// step as far as Coulomb's law allows. The normal and friction impulses of
+// all contacts are found together by projected Gauss-Seidel on the small
+// contact matrix and applied at once. One contact at a time, a box resting
+// on two corners picks up a spin from the first that tips it over. b is
+// not moved if b_fixed is set, but its motion still counts towards the slip.
+void SolveRigidContacts(
+    RigidBody* a, RigidBody* b, bool b_fixed, Vec2 n, Real friction,
+    std::vector<RigidContact>* contacts, std::vector<Real>* lambdas)
+{
+  auto& cs = *contacts;
+  const int num_contacts = cs.size();
+  const Vec2 t{-n.y, n.x};
+  for (auto& c : cs)
+  {
+    auto slip = c.point - a->GetPreviousPosition(c.point);
+    if (b != nullptr)
+      slip -= c.point - b->GetPreviousPosition(c.point);
+    c.slip = glm::dot(slip, t);
+  }
+  const auto movable_b = b_fixed ? nullptr : b;
+
+  // Rows [0, num_contacts) are normal, the rest tangential.
+  const int num_rows = friction > 0 ? 2*num_contacts : num_contacts;
+  auto& ls = *lambdas;
+  ls.assign(num_rows, 0);
+  for (int iter = 0; iter < 4*num_contacts; ++iter)
+  {
+    for (int i = 0; i < num_rows; ++i)
+    {
+      const auto& ci = cs[i%num_contacts];
+      const auto ui = i < num_contacts ? n : t;
+      auto residual = i < num_contacts ? ci.depth : -ci.slip;
+      Real w = 0;
+      for (int j = 0; j < num_rows; ++j)
+      {
+        const auto& cj = cs[j%num_contacts];
+        const auto uj = j < num_contacts ? n : t;
+        auto k = GetCoupling(a, ci.point, ui, cj.point, uj);
+        if (movable_b != nullptr)
+          k += GetCoupling(movable_b, ci.point, ui, cj.point, uj);
+        if (i == j)
+          w = k;
+        residual -= k*ls[j];
+      }
+      ls[i] += residual/w;
+      if (i < num_contacts)
+      {
+        ls[i] = std::max(Real(0), ls[i]);
+      }
+      else
+      {
+        const auto bound = friction*ls[i-num_contacts];
+        ls[i] = glm::clamp(ls[i], -bound, bound);
+      }
+    }
+  }
+
+  for (int i = 0; i < num_rows; ++i)
+  {
+    const auto& c = cs[i%num_contacts];
+    const auto impulse = ls[i]*(i < num_contacts ? n : t);
+    a->ApplyPositionImpulse(impulse, c.point);
+    if (movable_b != nullptr)
+      movable_b->ApplyPositionImpulse(-impulse, c.point);
+  }
+  for (int i = 0; i < num_contacts; ++i)
+  {
+    cs[i].lambda = ls[i];
+  }
+}
+
+}
+
+void Collisions::ResolveAllRigidBodyCollisions(Real dt)
+{
+  if (rigid_bodies_.empty())
+    return;
+
+  PBD_PROFILE_SCOPE(timer, RigidBodyCollisions);
+  rigid_body_boxes_.clear();
+  for (const auto body : rigid_bodies_)
+    rigid_body_boxes_.push_back(body->GetBoundingBox());
+  FindOverlappingPairs(
+      rigid_body_boxes_, &rigid_body_order_, &rigid_body_pairs_);
+  for (const auto& [i, j] : rigid_body_pairs_)
+  {
+    if (!ShouldCollide(rigid_body_filters_[i], rigid_body_filters_[j]))
+      continue;
+    PBD_PROFILE_TESTED(timer, 1);
+    ResolveRigidBodyPairCollision(rigid_bodies_[i], rigid_bodies_[j]);
+  }
+  for (int i = 0; i < rigid_bodies_.size(); ++i)
+  {
+    ResolveRigidBodyHalfPlaneCollisions(i);
+    ResolveRigidBodyPointCollisions(i, dt);
+  }
+}
+
+void Collisions::ResolveRigidBodyHalfPlaneCollisions(int index)
+{
+  const auto body = rigid_bodies_[index];
+  for (const auto& hp : half_planes_)
+  {
+    if (!ShouldCollide(rigid_body_filters_[index], hp.filter))
+      continue;
+    const auto& vertices = body->GetWorldVertices();
+    rigid_contacts_.clear();
+    for (int i = 0; i < vertices.size(); ++i)
+    {
+      const auto d = glm::dot(vertices[i] - hp.center, hp.normal);
+      if (d < kRigidContactMargin)
+        rigid_contacts_.push_back({body, i, vertices[i], -d, 0, 0});
+    }
+    if (rigid_contacts_.empty())
+      continue;
+
+    // The half-plane coefficient is the fraction of slip kept.
+    SolveRigidContacts(
+        body, nullptr, false, hp.normal, 1-hp.friction_coefficient,
+        &rigid_contacts_, &contact_lambdas_);
+    for (const auto& c : rigid_contacts_)
+    {
+      if (c.lambda == 0)
         continue;
+
+      stats_.num_contacts += 1;
+      stats_.max_penetration = std::max(stats_.max_penetration, c.depth);
+    }
+  }
+}
+
+void Collisions::ResolveRigidBodyPairCollision(RigidBody* a, RigidBody* b)
+{
+  const auto& va = a->GetWorldVertices();
+  const auto& vb = b->GetWorldVertices();
+  int face_a, face_b;
+  const auto separation_a = geometry::FindMaxSeparation(va, vb, &face_a);
+  if (separation_a > 0)
+    return;
+  const auto separation_b = geometry::FindMaxSeparation(vb, va, &face_b);
+  if (separation_b > 0)
+    return;
+
+  // The reference face is the one with the shallowest penetration, its
+  // normal points from the reference body towards the incident one. The
+  // tolerance keeps the choice from flipping between nearly parallel faces.
+  RigidBody* ref = a;
+  RigidBody* inc = b;
+  int face = face_a;
+  if (separation_b > Real(0.98)*separation_a + Real(0.001))
+  {
+    std::swap(ref, inc);
+    face = face_b;
+  }
+  const auto& ref_vertices = ref == a ? va : vb;
+  const auto& inc_vertices = ref == a ? vb : va;
+  const auto n = GetFaceNormal(ref_vertices, face);
+
+  // Contacts are the vertices of either body inside the other, or within
+  // the margin of it so that a resting contact does not flicker. Incident
+  // vertices are measured against the reference face, reference vertices
+  // against the incident face most opposed to n.
+  int inc_face = 0;
+  for (int i = 1; i < inc_vertices.size(); ++i)
+  {
+    if (glm::dot(GetFaceNormal(inc_vertices, i), n) <
+        glm::dot(GetFaceNormal(inc_vertices, inc_face), n))
+    {
+      inc_face = i;
+    }
+  }
+  const auto inc_normal = GetFaceNormal(inc_vertices, inc_face);
+  rigid_contacts_.clear();
+  for (int i = 0; i < inc_vertices.size(); ++i)
+  {
+    const auto& v = inc_vertices[i];
+    if (GetPointSeparation(ref_vertices, v) < kRigidContactMargin)
+    {
+      const auto d = glm::dot(v - ref_vertices[face], n);
+      rigid_contacts_.push_back({inc, i, v, -d, 0, 0});
+    }
+  }
+  for (int i = 0; i < ref_vertices.size(); ++i)
+  {
+    const auto& v = ref_vertices[i];
+    if (GetPointSeparation(inc_vertices, v) < kRigidContactMargin)
+    {
+      const auto d = glm::dot(v - inc_vertices[inc_face], inc_normal);
+      rigid_contacts_.push_back({ref, i, v, -d, 0, 0});
+    }
+  }
+  if (rigid_contacts_.empty())
+    return;
+
+  // Shock propagation: in a resting stack the lower body is not moved by
+  // the one above. Solved both ways, the lower body tilts under the load,
+  // drags the upper one along by friction and is then levelled by its own
+  // support without it, so stacks creep sideways.
+  const auto friction = std::sqrt(ref->GetFriction()*inc->GetFriction());
+  const auto g = inc->GetGravity();
+  const auto up = glm::dot(n, g) < -kSupportCosine*glm::length(g);
+  const auto down = glm::dot(n, g) > kSupportCosine*glm::length(g);
+  if (down)
+  {
+    // The incident body is below, solve from the reference body's side.
+    SolveRigidContacts(ref, inc, true, -n, friction,
+                       &rigid_contacts_, &contact_lambdas_);
+  }
+  else
+  {
+    SolveRigidContacts(inc, ref, up, n, friction,
+                       &rigid_contacts_, &contact_lambdas_);
+  }
+  for (const auto& c : rigid_contacts_)
+  {
+    if (c.lambda == 0)
+      continue;
+
+    stats_.num_contacts += 1;
+    stats_.max_penetration = std::max(stats_.max_penetration, c.depth);
+  }
+}
+
+void Collisions::ResolveRigidBodyPointCollisions(int index, Real dt)
+{
+  if (point_clouds_.empty())
+    return;
+
+  const auto body = rigid_bodies_[index];
+  const auto& filter = rigid_body_filters_[index];
+  const auto box = body->GetBoundingBox();
+  // Earlier passes may have moved particles since the grid was built.
+  const auto pad = grid_max_radius_ + point_grid_.GetCellSize();
+  point_grid_.Query(Vec2{box.x1-pad, box.y1-pad},
+                    Vec2{box.x2+pad, box.y2+pad}, [&](int id)
+  {
+    if (id >= grid_num_cloud_entries_ ||
+        !ShouldCollide(filter, grid_filters_[id]))
+    {
+      return;
+    }
+
+    const auto& pt = grid_points_[id];
+    const auto p = pt.pc->GetPoint(pt.idx);
+    const auto r = pt.pc->GetRadius(pt.idx);
+    const auto& vertices = body->GetWorldVertices();
+
+    // Face of least penetration for a particle of radius r.
+    Real separation = -std::numeric_limits<Real>::max();
+    Vec2 n;
+    for (int i = 0; i < vertices.size(); ++i)
+    {
+      const auto face_normal = GetFaceNormal(vertices, i);
+      const auto d = glm::dot(p - vertices[i], face_normal) - r;
+      if (d > separation)
+      {
+        separation = d;
+        n = face_normal;
       }
-      ResolvePolygonPointCollision(poly, point, dt);
     }
+    if (separation >= 0)
+      return;
+
+    stats_.num_contacts += 1;
+    stats_.max_penetration = std::max(stats_.max_penetration, -separation);
+    const auto contact = p - (separation + r)*n;
+    const auto pw = 1/pt.pc->GetMass(pt.idx);
+    const auto w = pw + body->GetGeneralizedInverseMass(contact, n);
+    const auto lambda = -separation/w;
+    pt.pc->DisplacePointAndUpdateVelocity(pt.idx, lambda*pw*n, dt);
+    body->ApplyPositionImpulse(-lambda*n, contact);
+  });
+}
+
+namespace
+{
+
+// A polygon keeps its previous reference face unless another face
+// separates the pair by more than this.
+constexpr Real kPolygonFaceHysteresis = 0.002;
+
+Real GetFaceSeparation(
+    const std::vector<Vec2>& a, const std::vector<Vec2>& b, int face)
+{
+  const auto e = a[(face+1)%a.size()] - a[face];
+  const auto normal = glm::normalize(Vec2{e.y, -e.x});
+  Real separation = std::numeric_limits<Real>::max();
+  for (const auto& v : b)
+  {
+    separation = std::min(separation, glm::dot(v - a[face], normal));
   }
+  return separation;
+}
+
+}
+
+void Collisions::ResolveAllPolygonPolygonCollisions(Real dt)
+{
+  PBD_PROFILE_SCOPE(timer, PolygonPolygonCollisions);
+  const int num_polygons = polygons_.size();
+  polygon_vertices_.resize(num_polygons);
+  polygon_boxes_.resize(num_polygons);
+  for (int i = 0; i < num_polygons; ++i)
+  {
+    polygon_boxes_[i] = polygons_[i].pc->GetBoundingBox();
+  }
+
+  FindOverlappingPairs(polygon_boxes_, &polygon_order_, &polygon_pairs_);
+  polygon_pairs_.erase(
+      std::remove_if(polygon_pairs_.begin(), polygon_pairs_.end(),
+          [&](const auto& p)
+          {
+            return polygons_[p.first].pc == polygons_[p.second].pc ||
+                   !ShouldCollide(polygon_filters_[p.first],
+                                  polygon_filters_[p.second]);
+          }),
+      polygon_pairs_.end());
+  PBD_PROFILE_TESTED(timer, polygon_pairs_.size());
+
+  // Stacks are solved from the bottom up, so that with the lower polygon
+  // held fixed a single pass carries the support through the stack.
+  const auto height = [&](int i)
+  {
+    const auto& box = polygon_boxes_[i];
+    const Vec2 center{(box.x1+box.x2)/2, (box.y1+box.y2)/2};
+    return -glm::dot(center, polygons_[i].pc->GetGravity());
+  };
+  std::sort(polygon_pairs_.begin(), polygon_pairs_.end(),
+      [&](const auto& p, const auto& q)
+      {
+        return std::min(height(p.first), height(p.second)) <
+               std::min(height(q.first), height(q.second));
+      });
+
+  for (const auto& [i, j] : polygon_pairs_)
+  {
+    Real penetration = 0.0;
+    const auto num_contacts =
+      ResolvePolygonPairCollision(i, j, dt, &penetration);
+    if (num_contacts > 0)
+    {
+      PBD_PROFILE_HITS(timer, num_contacts);
+      stats_.num_contacts += num_contacts;
+      stats_.max_penetration =
+        std::max(stats_.max_penetration, penetration);
+    }
+  }
+
+  // Pairs that stopped touching lose their manifold.
+  for (auto it = polygon_manifolds_.begin(); it != polygon_manifolds_.end();)
+  {
+    if (it->second.last_resolve != num_resolves_)
+      it = polygon_manifolds_.erase(it);
+    else
+      ++it;
+  }
+}
+
+int Collisions::ResolvePolygonPairCollision(int i, int j, Real dt,
+    Real* max_penetration)
+{
+  auto& a = polygon_vertices_[i];
+  auto& b = polygon_vertices_[j];
+  a.clear();
+  b.clear();
+  for (const auto& l : polygons_[i].line_segments)
+    a.push_back(l.pc->GetPoint(l.idx1));
+  for (const auto& l : polygons_[j].line_segments)
+    b.push_back(l.pc->GetPoint(l.idx1));
+
+  int face_a, face_b;
+  const auto separation_a = geometry::FindMaxSeparation(a, b, &face_a);
+  if (separation_a > 0)
+    return 0;
+  const auto separation_b = geometry::FindMaxSeparation(b, a, &face_b);
+  if (separation_b > 0)
+    return 0;
+
+  int reference = i;
+  int face = face_a;
+  auto separation = separation_a;
+  if (separation_b > Real(0.98)*separation_a + Real(0.001))
+  {
+    reference = j;
+    face = face_b;
+    separation = separation_b;
+  }
+
+  const auto key = (std::uint64_t(i) << 32) | std::uint64_t(j);
+  auto it = polygon_manifolds_.find(key);
+  if (it != polygon_manifolds_.end())
+  {
+    const auto& cached = it->second;
+    const auto& ref = cached.reference == i ? a : b;
+    const auto& inc = cached.reference == i ? b : a;
+    if (cached.face < static_cast<int>(ref.size()) &&
+        GetFaceSeparation(ref, inc, cached.face) >=
+          separation - kPolygonFaceHysteresis)
+    {
+      reference = cached.reference;
+      face = cached.face;
+    }
+  }
+  const auto incident = reference == i ? j : i;
+  const auto& ref = reference == i ? a : b;
+  const auto& inc = reference == i ? b : a;
+
+  const auto r1 = ref[face];
+  const auto r2 = ref[(face+1)%ref.size()];
+  const auto e = r2 - r1;
+  const auto normal = glm::normalize(Vec2{e.y, -e.x});
+
+  // The incident edge is the one facing the reference face the most.
+  const int num_inc = inc.size();
+  int edge = 0;
+  Real min_dot = std::numeric_limits<Real>::max();
+  for (int k = 0; k < num_inc; ++k)
+  {
+    const auto f = inc[(k+1)%num_inc] - inc[k];
+    const auto d = glm::dot(glm::normalize(Vec2{f.y, -f.x}), normal);
+    if (d < min_dot)
+    {
+      min_dot = d;
+      edge = k;
+    }
+  }
+
+  polygon_manifolds_[key] = {reference, face, num_resolves_};
+
+  const auto v1 = inc[edge];
+  const auto v2 = inc[(edge+1)%num_inc];
+  Real s[2];
+  if (!geometry::ClipSegmentToSlab(v1, v2, r1, r2, &s[0], &s[1]))
+    return 0;
+  const int num_clipped = s[1] > s[0] ? 2 : 1;
+
+  const auto& rs = polygons_[reference].line_segments[face];
+  const auto& is = polygons_[incident].line_segments[edge];
+  auto w_r1 = 1/rs.pc->GetMass(rs.idx1);
+  auto w_r2 = 1/rs.pc->GetMass(rs.idx2);
+  auto w_i1 = 1/is.pc->GetMass(is.idx1);
+  auto w_i2 = 1/is.pc->GetMass(is.idx2);
+
+  // Shock propagation: a polygon resting on another is pushed out alone,
+  // as if the one below it had infinite mass.
+  const auto g = is.pc->GetGravity();
+  const auto support = kSupportCosine*glm::length(g);
+  if (glm::dot(normal, g) < -support && w_i1 + w_i2 > 0)
+  {
+    w_r1 = 0;
+    w_r2 = 0;
+  }
+  else if (glm::dot(normal, g) > support && w_r1 + w_r2 > 0)
+  {
+    w_i1 = 0;
+    w_i2 = 0;
+  }
+
+  // Each clipped point of the incident edge is pushed out along the
+  // reference normal, weighted by where it lies on both edges.
+  int num_contacts = 0;
+  for (int k = 0; k < num_clipped; ++k)
+  {
+    const auto p1 = is.pc->GetPoint(is.idx1);
+    const auto p2 = is.pc->GetPoint(is.idx2);
+    const auto q1 = rs.pc->GetPoint(rs.idx1);
+    const auto q2 = rs.pc->GetPoint(rs.idx2);
+    const auto p = p1 + s[k]*(p2 - p1);
+    const auto u = glm::clamp(
+        glm::dot(p - q1, q2 - q1)/glm::dot(q2 - q1, q2 - q1), Real(0), Real(1));
+    const auto C = glm::dot(p - (q1 + u*(q2 - q1)), normal);
+    if (C >= 0)
+      continue;
+    const auto w = (1-s[k])*(1-s[k])*w_i1 + s[k]*s[k]*w_i2 +
+                   (1-u)*(1-u)*w_r1 + u*u*w_r2;
+    if (w == 0)
+      continue;
+    const auto lambda = -C/w;
+    is.pc->DisplacePointAndUpdateVelocity(
+        is.idx1, lambda*(1-s[k])*w_i1*normal, dt);
+    is.pc->DisplacePointAndUpdateVelocity(
+        is.idx2, lambda*s[k]*w_i2*normal, dt);
+    rs.pc->DisplacePointAndUpdateVelocity(
+        rs.idx1, -lambda*(1-u)*w_r1*normal, dt);
+    rs.pc->DisplacePointAndUpdateVelocity(
+        rs.idx2, -lambda*u*w_r2*normal, dt);
+    *max_penetration = std::max(*max_penetration, -C);
+    ++num_contacts;
+
+    // Friction removes the share of the relative tangential motion over the
+    // step that the reference side does not let slip, as for half-planes.
+    const auto slip = rs.friction_coefficient;
+    const auto tangent = Vec2{-normal.y, normal.x};
+    const auto dp =
+      (1-s[k])*(is.pc->GetPoint(is.idx1) -
+                is.pc->GetPointFromPreviousTimestep(is.idx1)) +
+      s[k]*(is.pc->GetPoint(is.idx2) -
+            is.pc->GetPointFromPreviousTimestep(is.idx2));
+    const auto dq =
+      (1-u)*(rs.pc->GetPoint(rs.idx1) -
+             rs.pc->GetPointFromPreviousTimestep(rs.idx1)) +
+      u*(rs.pc->GetPoint(rs.idx2) -
+         rs.pc->GetPointFromPreviousTimestep(rs.idx2));
+    const auto mu = -(1-slip)*glm::dot(dp - dq, tangent)/w;
+    is.pc->DisplacePointAndUpdateVelocity(
+        is.idx1, mu*(1-s[k])*w_i1*tangent, dt);
+    is.pc->DisplacePointAndUpdateVelocity(
+        is.idx2, mu*s[k]*w_i2*tangent, dt);
+    rs.pc->DisplacePointAndUpdateVelocity(
+        rs.idx1, -mu*(1-u)*w_r1*tangent, dt);
+    rs.pc->DisplacePointAndUpdateVelocity(
+        rs.idx2, -mu*u*w_r2*tangent, dt);
+  }
+  return num_contacts;
 }
 
 void Collisions::AddPolygon(PointCloud *pc)
 {
   std::vector<LineSeg> sides;
   const auto num_points = pc->GetNumPoints();
+  Real area = 0.0;
+  for (int i = 0; i < num_points; ++i)
+  {
+    area += geometry::Cross(pc->GetPoint(i), pc->GetPoint((i+1)%num_points));
+  }
+  // Sides run counter-clockwise so that their right-hand normals point out.
   for (int i = 0; i < num_points; ++i)
   {
-    sides.push_back({pc, i, (i+1)%num_points, 0.0});
+    if (area >= 0)
+      sides.push_back({pc, i, (i+1)%num_points, 0.0});
+    else
+      sides.push_back({pc, (num_points-i)%num_points, num_points-i-1, 0.0});
   }
   polygons_.push_back({pc, sides});
+  filters_dirty_ = true;
 }
 
 bool DetectContinuousPointLineSegCollision(
-    glm::dvec2 p, glm::dvec2 p_prev,
-    glm::dvec2 q1, glm::dvec2 q2)
+    Vec2 p, Vec2 p_prev,
+    Vec2 q1, Vec2 q2)
 {
-  glm::dvec2 intersec;
+  Vec2 intersec;
   return geometry::LinesegLinesegIntersection(
       p_prev, p, q1, q2, &intersec);
 }
 
-void ResolveHalfPlaneCollisions(PointCloud* pc, HalfPlane hp, double dt)
+int ResolveHalfPlaneCollisions(PointCloud* pc, HalfPlane hp, Real dt,
+    Real* max_penetration)
 {
+  int num_contacts = 0;
   for (int i = 0; i < pc->GetNumPoints(); ++i)
   {
-    const auto p = pc->GetPoint(i);
-    const auto d = glm::dot(p - hp.center, hp.normal);
-    if (d < 0.0)
-    {
-      pc->DisplacePointAndUpdateVelocity(i, -d*hp.normal, dt);
-      const auto v = pc->GetVelocity(i);
-      const auto vn = glm::dot(v,hp.normal)*hp.normal;
-      const auto vt = v-vn;
-      pc->SetVelocity(i, vn+hp.friction_coefficient*vt);
-    }
+    if (ResolveHalfPlaneCollision(pc, i, hp, dt, max_penetration))
+      num_contacts += 1;
   }
+  return num_contacts;
+}
+
+bool ResolveHalfPlaneCollision(PointCloud* pc, int i, HalfPlane hp, Real dt,
+    Real* max_penetration)
+{
+  const auto p = pc->GetPoint(i);
+  const auto d = glm::dot(p - hp.center, hp.normal);
+  if (d >= 0 || std::isinf(pc->GetMass(i)))
+    return false;
+
+  pc->DisplacePointAndUpdateVelocity(i, -d*hp.normal, dt);
+  if (pc->GetVelocityUpdate() == VelocityUpdate::FromPositions)
+  {
+    // Friction as a position correction, since the velocity is derived
+    // from the displacement over the step.
+    const auto dx = pc->GetPoint(i) - pc->GetPointFromPreviousTimestep(i);
+    const auto dxt = dx - glm::dot(dx,hp.normal)*hp.normal;
+    pc->DisplacePoint(i, -(1-hp.friction_coefficient)*dxt);
+  }
+  else
+  {
+    const auto v = pc->GetVelocity(i);
+    const auto vn = glm::dot(v,hp.normal)*hp.normal;
+    const auto vt = v-vn;
+    pc->SetVelocity(i, vn+hp.friction_coefficient*vt);
+  }
+  if (max_penetration)
+  {
+    *max_penetration = std::max(*max_penetration, -d);
+  }
+  return true;
 }
 
 void ResolvePointLineSegCollision(
-    glm::dvec2 p, double pmass,
-    glm::dvec2 q1, double q1mass,
-    glm::dvec2 q2, double q2mass,
-    glm::dvec2* dp, glm::dvec2* dq1, glm::dvec2* dq2)
-{
-  glm::dvec2 closest_point;
-
-  const glm::dvec2 tangent = glm::normalize(q2-q1);
-  const glm::dvec2 proj = glm::dot(p-q1,tangent)*tangent;
-  const glm::dvec2 dir = proj-(p-q1);
-  const double total_mass = pmass+q1mass+q2mass;
-  const double pw = pmass/total_mass;
-  const double qw = q1mass+q2mass/total_mass;
+    Vec2 p, Real pmass,
+    Vec2 q1, Real q1mass,
+    Vec2 q2, Real q2mass,
+    Vec2* dp, Vec2* dq1, Vec2* dq2)
+{
+  Vec2 closest_point;
+
+  const Vec2 tangent = glm::normalize(q2-q1);
+  const Vec2 proj = glm::dot(p-q1,tangent)*tangent;
+  const Vec2 dir = proj-(p-q1);
+  Real pw = 0.0;
+  Real qw = 0.0;
+  GetContactWeights(pmass, q1mass, q2mass, &pw, &qw);
   *dp = pw*dir;
   *dq1 = -qw*dir;
   *dq2 = -qw*dir;
 }
 
-void ResolvePolygonPointCollision(
+bool ResolvePolygonPointCollision(
     Polygon poly,
     Point point,
-    double dt)
+    Real dt,
+    Real* penetration)
 {
-  const glm::dvec2 ray_dir{1.0, 0.0};
+  const Vec2 ray_dir{1.0, 0.0};
 
   int num_intersections = 0;
   const auto p = point.pc->GetPoint(point.idx);
   for (const auto& l : poly.line_segments)
   {
-    glm::dvec2 intersec;
+    Vec2 intersec;
     const auto q1 = l.pc->GetPoint(l.idx1);
     const auto q2 = l.pc->GetPoint(l.idx2);
     const auto hit = geometry::RayLinesegIntersection(
@@ -223,12 +1463,12 @@ void ResolvePolygonPointCollision(
     const auto q1 = l0.pc->GetPoint(l0.idx1);
     const auto q2 = l0.pc->GetPoint(l0.idx2);
     const auto smallest_dist = geometry::PointLinesegDistance(p, q1, q2);
-    glm::dvec2 cp;
+    Vec2 cp;
     int closest_idx = 0;
 
     for (int i = 0; i < poly.line_segments.size(); ++i)
     {
-      glm::dvec2 intersec;
+      Vec2 intersec;
       const auto& l = poly.line_segments[i];
       const auto q1 = l.pc->GetPoint(l.idx1);
       const auto q2 = l.pc->GetPoint(l.idx2);
@@ -244,20 +1484,26 @@ void ResolvePolygonPointCollision(
 
     const auto& cl = poly.line_segments[closest_idx];
     const auto dir = cp - p;
-    const auto pmass = point.pc->GetMass(point.idx);
-    const auto q1mass = cl.pc->GetMass(cl.idx1);
-    const auto q2mass = cl.pc->GetMass(cl.idx2);
-    const double total_mass = pmass+q1mass+q2mass;
-    const double pw = pmass/total_mass;
-    const double qw = q1mass+q2mass/total_mass;
+    Real pw, qw;
+    if (!GetContactWeights(point.pc->GetMass(point.idx),
+          cl.pc->GetMass(cl.idx1), cl.pc->GetMass(cl.idx2), &pw, &qw))
+    {
+      return false;
+    }
     const auto dp = pw*dir;
     const auto dq1 = -qw*dir;
     const auto dq2 = -qw*dir;
     point.pc->DisplacePointAndUpdateVelocity(point.idx, dp, dt);
     cl.pc->DisplacePointAndUpdateVelocity(cl.idx1, dq1, dt);
     cl.pc->DisplacePointAndUpdateVelocity(cl.idx2, dq2, dt);
+    if (penetration)
+    {
+      *penetration = glm::length(dir);
+    }
+    return true;
   }
 
+  return false;
 }
 
 }
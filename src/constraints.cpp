@@ -1,90 +1,70 @@
 #include "constraints.hpp"
-
-#include <glm/gtx/vector_angle.hpp>
-#define GLM_FORCE_RADIANS
+#include "constraint_kernels.hpp"
 
 #include <algorithm>
 
 namespace pbd
 {
 
-void GetLengthConstraintDelta(
-    glm::dvec2 p, double pmass,
-    glm::dvec2 q, double qmass,
-    double target_len,
-    double stiffness,
-    glm::dvec2* dp,
-    glm::dvec2* dq)
+Real GetLengthConstraintDelta(
+    Vec2 p, Real pmass,
+    Vec2 q, Real qmass,
+    Real target_len,
+    Real stiffness,
+    Vec2* dp,
+    Vec2* dq)
 {
-  const auto u = q-p;
-  const auto ulen = glm::length(u);
-  const auto C = ulen - target_len;
-  const auto dCdu = u/ulen;
-  const auto dCdp = -dCdu;
-  const auto dCdq = dCdu;
-  const auto pw = 1/pmass;
-  const auto qw = 1/qmass;
-  const auto s = C/(pw*glm::length2(dCdp) + qw*glm::length2(dCdq));
-  *dp = -s*stiffness*pw*dCdp;
-  *dq = -s*stiffness*qw*dCdq;
+  using namespace kernels;
+  const auto c = ProjectLength<LinearStiffness, PerParticleMass, NoPinning>(
+      p, pmass, q, qmass, target_len, stiffness, 1);
+  *dp = c.dp;
+  *dq = c.dq;
+  return c.C;
 }
 
-void GetBendConstraintDelta(
-    glm::dvec2 p, double pmass,
-    glm::dvec2 q, double qmass,
-    glm::dvec2 r, double rmass,
-    double segment_length,
-    double stiffness,
-    glm::dvec2* dp,
-    glm::dvec2* dq,
-    glm::dvec2* dr)
+Real GetBendConstraintDelta(
+    Vec2 p, Real pmass,
+    Vec2 q, Real qmass,
+    Vec2 r, Real rmass,
+    Real segment_length,
+    Real stiffness,
+    Vec2* dp,
+    Vec2* dq,
+    Vec2* dr)
 {
-  const auto u = q-p;
-  const auto v = r-q;
-  const glm::dvec2 uperp{u.y, -u.x};
-  const glm::dvec2 vperp{v.y, -v.x};
-  const auto ulen = glm::length(u);
-  const auto vlen = glm::length(v);
-  const auto ub = glm::normalize(u);
-  const auto vb = glm::normalize(v);
-  const auto uperpb = glm::normalize(uperp);
-  const auto vperpb = glm::normalize(vperp);
-  const auto udotv = glm::dot(u,v);
-  const auto udotvperp = glm::dot(u,vperp);
-  if (glm::abs(ulen*vlen+udotv) < 1e-10)
-  {
-    *dp = {0.0, 0.0};
-    *dq = {0.0, 0.0};
-    *dr = {0.0, 0.0};
+  using namespace kernels;
+  const auto c = ProjectBend<LinearStiffness, PerParticleMass, NoPinning>(
+      p, pmass, q, qmass, r, rmass, segment_length, stiffness, 1);
+  *dp = c.dp;
+  *dq = c.dq;
+  *dr = c.dr;
+  return c.C;
+}
+
+void SolveTridiagonal(
+    const std::vector<Real>& a,
+    const std::vector<Real>& b,
+    std::vector<Real>* c,
+    std::vector<Real>* d)
+{
+  auto& cc = *c;
+  auto& dd = *d;
+  const int n = b.size();
+  if (n == 0)
     return;
-  }
-  const auto a = 1.0/(ulen*vlen+udotv);
-  const auto dbdu = 2.0*a*vlen*(vperpb - udotvperp*a*(ub+vb));
-  const auto dbdv = -2.0*a*ulen*(uperpb + udotvperp*a*(ub+vb));
-  const auto b = 2.0*udotvperp/(ulen*vlen+udotv)/segment_length;
-  const auto dCdu = 2.0*b*dbdu/segment_length;
-  const auto dCdv = 2.0*b*dbdv/segment_length;
 
-  const auto dCdp = -dCdu;
-  const auto dCdq = dCdu-dCdv;
-  const auto dCdr = dCdv;
-  const auto C = b*b;
-  if (C < 1e-10)
+  cc[0] /= b[0];
+  dd[0] /= b[0];
+  for (int i = 1; i < n; ++i)
   {
-    *dp = {0.0, 0.0};
-    *dq = {0.0, 0.0};
-    *dr = {0.0, 0.0};
-    return;
+    const auto m = 1/(b[i] - a[i]*cc[i-1]);
+    cc[i] *= m;
+    dd[i] = (dd[i] - a[i]*dd[i-1])*m;
+  }
+  for (int i = n-2; i >= 0; --i)
+  {
+    dd[i] -= cc[i]*dd[i+1];
   }
-  const auto pw = 1/pmass;
-  const auto qw = 1/qmass;
-  const auto rw = 1/rmass;
-  const auto s = C/(pw*glm::length2(dCdp) +
-                    qw*glm::length2(dCdq) +
-                    rw*glm::length2(dCdr));
-  *dp = -s*stiffness*pw*dCdp;
-  *dq = -s*stiffness*qw*dCdq;
-  *dr = -s*stiffness*rw*dCdr;
 }
 
 }
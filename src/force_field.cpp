@@ -0,0 +1,78 @@
+#include "force_field.hpp"
+
+#include "collisions.hpp"
+#include "point_cloud.hpp"
+
+#include <algorithm>
+
+namespace pbd
+{
+
+Vec2 EvaluateForceField(
+    const ForceField& field, Vec2 p, Vec2 v)
+{
+  const auto r = p - field.center;
+  const auto d = glm::length(r);
+  if (d >= field.radius)
+    return {0.0, 0.0};
+
+  const Real falloff = Real(1) - d/field.radius;
+  switch (field.type)
+  {
+    case ForceFieldType::Radial:
+      if (d < Real(1e-10))
+        return {0.0, 0.0};
+      return field.strength*falloff*r/d;
+    case ForceFieldType::Directional:
+      return field.strength*falloff*field.direction;
+    case ForceFieldType::Vortex:
+      if (d < Real(1e-10))
+        return {0.0, 0.0};
+      return field.strength*falloff*Vec2{-r.y, r.x}/d;
+    case ForceFieldType::Drag:
+      return -field.strength*falloff*v;
+  }
+
+  return {0.0, 0.0};
+}
+
+int ForceFieldSet::AddField(const ForceField& field)
+{
+  fields_.push_back({next_handle_, field});
+  return next_handle_++;
+}
+
+void ForceFieldSet::RemoveField(int handle)
+{
+  fields_.erase(
+      std::remove_if(fields_.begin(), fields_.end(),
+          [handle](const auto& f) { return f.first == handle; }),
+      fields_.end());
+}
+
+ForceField* ForceFieldSet::GetField(int handle)
+{
+  for (auto& f : fields_)
+  {
+    if (f.first == handle)
+      return &f.second;
+  }
+  return nullptr;
+}
+
+void ForceFieldSet::Apply(collisions::Collisions* collisions) const
+{
+  for (const auto& f : fields_)
+  {
+    const auto& field = f.second;
+    collisions->ForEachPointInRadius(field.center, field.radius,
+        [&field](const collisions::Point& pt)
+        {
+          const auto p = pt.pc->GetPoint(pt.idx);
+          const auto v = pt.pc->GetVelocity(pt.idx);
+          pt.pc->AddForce(pt.idx, EvaluateForceField(field, p, v));
+        });
+  }
+}
+
+}
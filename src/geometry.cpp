@@ -1,24 +1,25 @@
 #include "geometry.hpp"
 #include <algorithm>
+#include <limits>
 
 namespace geometry
 {
 bool LinesegLinesegIntersection(
-    const glm::dvec2& p1,
-    const glm::dvec2& p2,
-    const glm::dvec2& q1,
-    const glm::dvec2& q2,
-    glm::dvec2* intersection_point)
+    const Vec2& p1,
+    const Vec2& p2,
+    const Vec2& q1,
+    const Vec2& q2,
+    Vec2* intersection_point)
 {
-  const glm::dvec2 r = p2 - p1;
-  const glm::dvec2 s = q2 - q1;
+  const Vec2 r = p2 - p1;
+  const Vec2 s = q2 - q1;
 
-  const double n = Cross(q1-p1,r);
-  const double d = Cross(r,s);
-  const double u = n/d;
-  const double t = Cross(q1-p1,s)/d;
+  const Real n = Cross(q1-p1,r);
+  const Real d = Cross(r,s);
+  const Real u = n/d;
+  const Real t = Cross(q1-p1,s)/d;
 
-  if (!(d != 0.0 && 0.0 <= t && t <= 1.0 && 0.0 <= u && u <= 1.0))
+  if (!(d != 0 && 0 <= t && t <= 1 && 0 <= u && u <= 1))
   {
     return false;
   }
@@ -30,67 +31,69 @@ bool LinesegLinesegIntersection(
 
 }
 
-double PointLinesegDistance(
-    const glm::dvec2& v,
-    const glm::dvec2& e1,
-    const glm::dvec2& e2,
-    glm::dvec2* closest_point)
+Real PointLinesegDistance(
+    const Vec2& v,
+    const Vec2& e1,
+    const Vec2& e2,
+    Vec2* closest_point)
 {
-  const double l2 = glm::dot(e1-e2,e1-e2);
-  if (l2 == 0.0) return glm::length(v-e1);
-  const double t = std::max(0.0, std::min(1.0, dot(v - e1, e2 - e1) / l2));
+  const Real l2 = glm::dot(e1-e2,e1-e2);
+  if (l2 == 0) return glm::length(v-e1);
+  const Real t =
+      std::max(Real(0), std::min(Real(1), dot(v - e1, e2 - e1) / l2));
   *closest_point = e1 + t * (e2 - e1);
   return glm::length(v-*closest_point);
 }
 
-double PointLinesegDistance(
-    const glm::dvec2& v,
-    const glm::dvec2& e1,
-    const glm::dvec2& e2)
+Real PointLinesegDistance(
+    const Vec2& v,
+    const Vec2& e1,
+    const Vec2& e2)
 {
-  const double l2 = glm::dot(e1-e2,e1-e2);
-  if (l2 == 0.0) return glm::length(v-e1);
-  const double t = std::max(0.0, std::min(1.0, dot(v - e1, e2 - e1) / l2));
+  const Real l2 = glm::dot(e1-e2,e1-e2);
+  if (l2 == 0) return glm::length(v-e1);
+  const Real t =
+      std::max(Real(0), std::min(Real(1), dot(v - e1, e2 - e1) / l2));
   auto closest_point = e1 + t * (e2 - e1);
   return glm::length(v-closest_point);
 }
 
-double PointLineDistance(
-    const glm::dvec2& v,
-    const glm::dvec2& p,
-    const glm::dvec2& normal)
+Real PointLineDistance(
+    const Vec2& v,
+    const Vec2& p,
+    const Vec2& normal)
 {
   return glm::abs(glm::dot(v-p,normal));
 }
 
-double PointLineSignedDistance(
-    const glm::dvec2& v,
-    const glm::dvec2& p,
-    const glm::dvec2& normal)
+Real PointLineSignedDistance(
+    const Vec2& v,
+    const Vec2& p,
+    const Vec2& normal)
 {
   return glm::dot(v-p,normal);
 }
 
-double Cross(
-    const glm::dvec2& u,
-    const glm::dvec2& v)
+Real Cross(
+    const Vec2& u,
+    const Vec2& v)
 {
   return u.x*v.y - u.y*v.x;
 }
 
 bool RayLinesegIntersection(
-    const glm::dvec2& ray_origin,
-    const glm::dvec2& ray_direction,
-    const glm::dvec2& p1,
-    const glm::dvec2& p2,
-    glm::dvec2* intersection_point)
+    const Vec2& ray_origin,
+    const Vec2& ray_direction,
+    const Vec2& p1,
+    const Vec2& p2,
+    Vec2* intersection_point)
 {
   const auto v1 = ray_origin - p1;
   const auto v2 = p2 - p1;
-  const glm::dvec2 v3{-ray_direction.y, ray_direction.x};
+  const Vec2 v3{-ray_direction.y, ray_direction.x};
   const auto dot = glm::dot(v2,v3);
 
-  if (glm::abs(dot) < 1e-10)
+  if (glm::abs(dot) < Real(1e-10))
   {
     return false;
   }
@@ -98,7 +101,7 @@ bool RayLinesegIntersection(
   const auto t1 = Cross(v2, v1) / dot;
   const auto t2 = glm::dot(v1,v3) / dot;
 
-  if (t1 >= 0.0 && t2 >= 0.0 && t2 <= 1.0)
+  if (t1 >= 0 && t2 >= 0 && t2 <= 1)
   {
     *intersection_point = ray_origin + t1*ray_direction;
     return true;
@@ -107,4 +110,101 @@ bool RayLinesegIntersection(
   return false;
 }
 
+bool PointInPolygon(
+    const Vec2& v,
+    const std::vector<Vec2>& polygon)
+{
+  bool inside = false;
+  const int n = polygon.size();
+  for (int i = 0, j = n-1; i < n; j = i++)
+  {
+    const auto& a = polygon[i];
+    const auto& b = polygon[j];
+    if ((a.y > v.y) != (b.y > v.y) &&
+        v.x < a.x + (v.y-a.y)*(b.x-a.x)/(b.y-a.y))
+    {
+      inside = !inside;
+    }
+  }
+  return inside;
+}
+
+bool ClipSegmentToSlab(
+    const Vec2& p1,
+    const Vec2& p2,
+    const Vec2& a,
+    const Vec2& b,
+    Real* s1,
+    Real* s2)
+{
+  const auto t = b - a;
+  const auto len2 = glm::dot(t, t);
+  // Coordinate along a-b, linear in the segment parameter.
+  const auto f1 = glm::dot(p1 - a, t);
+  const auto f2 = glm::dot(p2 - a, t);
+  Real lo = 0;
+  Real hi = 1;
+  const auto df = f2 - f1;
+  if (df == 0)
+  {
+    if (f1 < 0 || f1 > len2)
+      return false;
+  }
+  else
+  {
+    auto e1 = (0 - f1)/df;
+    auto e2 = (len2 - f1)/df;
+    if (e1 > e2)
+      std::swap(e1, e2);
+    lo = std::max(lo, e1);
+    hi = std::min(hi, e2);
+  }
+  if (lo > hi)
+    return false;
+  *s1 = lo;
+  *s2 = hi;
+  return true;
+}
+
+bool RectsOverlap(const Rect& a, const Rect& b)
+{
+  return a.x1 <= b.x2 && b.x1 <= a.x2 && a.y1 <= b.y2 && b.y1 <= a.y2;
+}
+
+bool RectContainsRect(const Rect& outer, const Rect& inner)
+{
+  return outer.x1 <= inner.x1 && inner.x2 <= outer.x2 &&
+         outer.y1 <= inner.y1 && inner.y2 <= outer.y2;
+}
+
+bool RectContainsPoint(const Rect& r, const Vec2& p)
+{
+  return r.x1 <= p.x && p.x <= r.x2 && r.y1 <= p.y && p.y <= r.y2;
+}
+
+Real FindMaxSeparation(
+    const std::vector<Vec2>& a,
+    const std::vector<Vec2>& b,
+    int* face)
+{
+  const int n = a.size();
+  Real max_separation = -std::numeric_limits<Real>::max();
+  for (int i = 0; i < n; ++i)
+  {
+    const auto e = a[(i+1)%n] - a[i];
+    const auto normal = glm::normalize(Vec2{e.y, -e.x});
+    Real separation = std::numeric_limits<Real>::max();
+    for (const auto& v : b)
+    {
+      separation = std::min(separation, glm::dot(v - a[i], normal));
+    }
+    if (separation > max_separation)
+    {
+      max_separation = separation;
+      *face = i;
+    }
+  }
+  return max_separation;
+}
+
 }
@@ -2,6 +2,7 @@
 #include "sandbox.hpp"
 #include "sandbox_render.hpp"
 #include "sandbox_input.hpp"
+#include "sandbox_hud.hpp"
 
 #include "osksdl.hpp"
 
@@ -33,6 +34,8 @@ int main(int argc, char *argv[])
         }
     }
 
+    sandbox::FreeHud();
+    sandbox::FreeRenderResources();
     osksdl::QuitSDL();
 
     return 0;
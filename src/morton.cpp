@@ -0,0 +1,70 @@
+#include "morton.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace pbd
+{
+
+namespace
+{
+
+uint32_t SpreadBits(uint32_t v)
+{
+  v &= 0x0000ffff;
+  v = (v | (v << 8)) & 0x00ff00ff;
+  v = (v | (v << 4)) & 0x0f0f0f0f;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+}
+
+}
+
+uint32_t MortonCode(uint32_t x, uint32_t y)
+{
+  return SpreadBits(x) | (SpreadBits(y) << 1);
+}
+
+std::vector<int> ComputeMortonOrder(const std::vector<Vec2>& points)
+{
+  const int num_points = points.size();
+  std::vector<int> order(num_points);
+  if (num_points == 0)
+    return order;
+
+  Vec2 lo = points[0];
+  Vec2 hi = points[0];
+  for (const auto& p : points)
+  {
+    lo = glm::min(lo, p);
+    hi = glm::max(hi, p);
+  }
+
+  const Real extent = std::max(hi.x-lo.x, hi.y-lo.y);
+  const Real scale = extent > 0 ? Real(65535)/extent : Real(0);
+
+  std::vector<std::pair<uint32_t,int>> keys(num_points);
+  for (int i = 0; i < num_points; ++i)
+  {
+    const auto q = (points[i]-lo)*scale;
+    keys[i] = {MortonCode(static_cast<uint32_t>(q.x),
+                          static_cast<uint32_t>(q.y)), i};
+  }
+  std::sort(keys.begin(), keys.end());
+
+  for (int i = 0; i < num_points; ++i)
+    order[i] = keys[i].second;
+
+  return order;
+}
+
+std::vector<int> InvertPermutation(const std::vector<int>& permutation)
+{
+  std::vector<int> inverse(permutation.size());
+  for (int i = 0; i < permutation.size(); ++i)
+    inverse[permutation[i]] = i;
+  return inverse;
+}
+
+}
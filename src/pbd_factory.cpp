@@ -1,20 +1,23 @@
 #include "pbd_factory.hpp"
+#include "area_constraint.hpp"
 
 #include <glm/gtc/constants.hpp>
 
+#include <utility>
+
 
 namespace pbd
 {
 
 std::unique_ptr<PbdSystem> MakeRod(
-    double length, double mass, int num_edges,
-    double stretch_resistance, double bend_resistance)
+    Real length, Real mass, int num_edges,
+    Real stretch_resistance, Real bend_resistance)
 {
   std::unique_ptr<PbdSystem> rod =
       std::make_unique<PbdSystem>(num_edges+1);
 
   const auto edge_len = length/num_edges;
-  const double angle = glm::pi<double>();
+  const Real angle = glm::pi<Real>();
   const int num_iter = 1;
 
   for (int i = 0; i < num_edges; ++i)
@@ -37,14 +40,14 @@ std::unique_ptr<PbdSystem> MakeRod(
 }
 
 std::unique_ptr<PbdSystem> MakeSquare(
-    double side_length, double stiffness)
+    Real side_length, Real stiffness)
 {
   std::unique_ptr<PbdSystem> square =
       std::make_unique<PbdSystem>(4);
 
   const int num_iter = 1;
 
-  const double c = glm::length(glm::dvec2{side_length, side_length});
+  const Real c = glm::length(Vec2{side_length, side_length});
   square->AddLengthConstraint(0,1,side_length,stiffness,num_iter);
   square->AddLengthConstraint(1,2,side_length,stiffness,num_iter);
   square->AddLengthConstraint(2,3,side_length,stiffness,num_iter);
@@ -60,4 +63,61 @@ std::unique_ptr<PbdSystem> MakeSquare(
   return square;
 }
 
+std::unique_ptr<PbdSystem> MakeSoftBody(
+    Real radius, int num_vertices, Real mass,
+    Real stiffness, Real pressure)
+{
+  std::unique_ptr<PbdSystem> body =
+      std::make_unique<PbdSystem>(num_vertices);
+
+  const int num_iter = 1;
+  const Real angle = 2*glm::pi<Real>()/num_vertices;
+  const Real edge_len = 2*radius*glm::sin(angle/2);
+
+  AreaConstraint area{{}, 0, pressure, stiffness};
+  for (int i = 0; i < num_vertices; ++i)
+  {
+    body->SetPoint(i, radius*Vec2{glm::cos(i*angle), glm::sin(i*angle)});
+    body->SetMass(i, mass/num_vertices);
+    body->AddLengthConstraint(
+        i,(i+1)%num_vertices,edge_len,stiffness,num_iter);
+    area.indices.push_back(i);
+  }
+  area.rest_area = GetPolygonArea(*body, area.indices);
+  body->AddConstraint(area);
+
+  return body;
+}
+
+std::unique_ptr<PbdSystem> MakeShapeMatchingBox(
+    Real width, Real height, int nx, int ny, Real mass,
+    Real stiffness, ShapeMatchingMode mode)
+{
+  const int num_points = nx*ny;
+  std::unique_ptr<PbdSystem> box =
+      std::make_unique<PbdSystem>(num_points);
+
+  std::vector<int> indices;
+  for (int j = 0; j < ny; ++j)
+  {
+    for (int i = 0; i < nx; ++i)
+    {
+      const int idx = j*nx + i;
+      const Real x = nx > 1 ? width*i/(nx-1) : 0;
+      const Real y = ny > 1 ? height*j/(ny-1) : 0;
+      box->SetPoint(idx, {x, y});
+      box->SetMass(idx, mass/num_points);
+      indices.push_back(idx);
+    }
+  }
+
+  // Yield at a tenth of the box size, creeping a little per projection.
+  const Real yield = glm::min(width, height)/10;
+  const Real creep = 0.1;
+  box->AddConstraint(MakeShapeMatchingConstraint(
+        *box, std::move(indices), stiffness, mode, yield, creep));
+
+  return box;
+}
+
 }
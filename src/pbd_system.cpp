@@ -1,6 +1,12 @@
 #include "pbd_system.hpp"
 #include "constraints.hpp"
+#include "constraint_kernels.hpp"
+#include "morton.hpp"
 #include "point_cloud.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
 
 namespace pbd
 {
@@ -8,36 +14,266 @@ namespace pbd
 void PbdSystem::AddLengthConstraint(
     int idx1,
     int idx2,
-    double target_len,
-    double stiffness,
+    Real target_len,
+    Real stiffness,
     int num_iter)
 {
-  stiffness = glm::clamp(stiffness, 0.0, 1.0);
+  stiffness = glm::clamp(stiffness, Real(0), Real(1));
   length_constraints_.push_back(
       {idx1, idx2, target_len, stiffness, num_iter});
+  fused_order_dirty_ = true;
+  chain_dirty_ = true;
 }
 
 void PbdSystem::AddBendConstraint(
     int idx1,
     int idx2,
     int idx3,
-    double segment_length,
-    double stiffness,
+    Real segment_length,
+    Real stiffness,
     int num_iter)
 {
-  stiffness = glm::clamp(stiffness, 0.0, 1.0);
+  stiffness = glm::clamp(stiffness, Real(0), Real(1));
   bend_constraints_.push_back(
       {idx1, idx2, idx3, segment_length, stiffness, num_iter});
 }
 
-void PbdSystem::Integrate(double dt)
+int PbdSystem::GetNumLengthConstraints() const
+{
+  return length_constraints_.size();
+}
+
+int PbdSystem::GetNumBendConstraints() const
+{
+  return bend_constraints_.size();
+}
+
+int PbdSystem::GetNumConstraints() const
+{
+  int num_constraints = length_constraints_.size() + bend_constraints_.size();
+  for (const auto& batch : constraint_batches_)
+  {
+    num_constraints += batch->GetSize();
+  }
+  return num_constraints;
+}
+
+void PbdSystem::SetFusedIntegration(bool on)
+{
+  fused_integration_ = on;
+}
+
+void PbdSystem::SetStiffnessModel(StiffnessModel model)
 {
-  PointCloud::Integrate(dt);
-  HandleLengthConstraints(dt);
+  stiffness_model_ = model;
+}
+
+void PbdSystem::SetDirectChainSolve(bool on)
+{
+  direct_chain_solve_ = on;
+}
+
+void PbdSystem::SetSolverIterations(int num_iterations, Real tolerance)
+{
+  num_solver_iterations_ = num_iterations;
+  solver_tolerance_ = tolerance;
+}
+
+void PbdSystem::SetErrorHistogram(int num_bins, Real max_error)
+{
+  auto& histogram = residuals_.length_error_histogram;
+  if (num_bins <= 0 || !(max_error > 0))
+  {
+    histogram.clear();
+    return;
+  }
+  histogram.assign(num_bins, 0);
+  histogram_max_error_ = max_error;
+}
+
+void PbdSystem::ResetLengthResiduals()
+{
+  length_errors_ = {};
+  auto& histogram = residuals_.length_error_histogram;
+  std::fill(histogram.begin(), histogram.end(), 0);
+}
+
+void PbdSystem::AddLengthResidual(Real error)
+{
+  error = std::abs(error);
+  length_errors_.max = std::max(length_errors_.max, error);
+  length_errors_.sum2 += error*error;
+  length_errors_.count += 1;
+
+  auto& histogram = residuals_.length_error_histogram;
+  if (!histogram.empty())
+  {
+    // Clamped before the conversion, NaN going to the last bin.
+    const int n = histogram.size();
+    const auto x = error/histogram_max_error_*n;
+    const int bin = x < n-1 ? static_cast<int>(x) : n-1;
+    histogram[bin] += 1;
+  }
+}
+
+void PbdSystem::Integrate(Real dt)
+{
+  max_correction2_ = 0.0;
+  const bool chain = direct_chain_solve_ && UpdateChain();
+  if (fused_integration_ && !chain)
+  {
+    IntegrateAndHandleLengthConstraints(dt);
+  }
+  else
+  {
+    PointCloud::Integrate(dt);
+    HandleLengthConstraints(dt);
+  }
   HandleBendConstraints(dt);
+  HandleCustomConstraints(dt);
+  num_iterations_last_step_ = 1;
+
+  const bool chebyshev = IsChebyshevActive();
+  if (chebyshev)
+  {
+    chebyshev_last_ = GetPoints();
+    chebyshev_before_last_.clear();
+  }
+
+  Real omega = 1.0;
+  const auto rho2 = spectral_radius_*spectral_radius_;
+  const auto tolerance2 = solver_tolerance_*solver_tolerance_;
+  while (num_iterations_last_step_ < num_solver_iterations_ &&
+         max_correction2_ >= tolerance2)
+  {
+    max_correction2_ = 0.0;
+    HandleLengthConstraints(dt);
+    HandleBendConstraints(dt);
+    HandleCustomConstraints(dt);
+    num_iterations_last_step_ += 1;
+
+    if (chebyshev)
+    {
+      // Acceleration starts on the third sweep, once two previous iterates
+      // are known.
+      if (num_iterations_last_step_ == 3)
+      {
+        omega = Real(2)/(Real(2)-rho2);
+      }
+      else if (num_iterations_last_step_ > 3)
+      {
+        omega = Real(4)/(Real(4)-rho2*omega);
+      }
+      ApplyChebyshevStep(omega, dt);
+    }
+  }
+
+  const auto rms = [](const ErrorAccumulator& e)
+  {
+    return e.count > 0 ? std::sqrt(e.sum2/e.count) : Real(0);
+  };
+  residuals_.max_length_error = length_errors_.max;
+  residuals_.rms_length_error = rms(length_errors_);
+  residuals_.max_bend_error = bend_errors_.max;
+  residuals_.rms_bend_error = rms(bend_errors_);
+  residuals_.num_iterations = num_iterations_last_step_;
+}
+
+void PbdSystem::SetOverRelaxation(Real omega)
+{
+  over_relaxation_ = glm::clamp(omega, Real(0), Real(1.99));
+}
+
+void PbdSystem::SetChebyshevAcceleration(Real spectral_radius)
+{
+  spectral_radius_ = glm::clamp(spectral_radius, Real(0), Real(0.95));
+}
+
+bool PbdSystem::IsChebyshevActive() const
+{
+  return spectral_radius_ > 0 && num_solver_iterations_ > 1;
+}
+
+Real PbdSystem::GetOverRelaxation() const
+{
+  // The Chebyshev step already extrapolates the sweeps.
+  return IsChebyshevActive() ? Real(1) : over_relaxation_;
 }
 
-void PbdSystem::DampVelocity(double damping)
+void PbdSystem::ApplyChebyshevStep(Real omega, Real dt)
+{
+  // x_k+1 = omega*(x_k+1 - x_k-1) + x_k-1, where x_k-1 is the iterate from
+  // two sweeps ago.
+  const auto& points = GetPoints();
+  if (omega != 1 && !chebyshev_before_last_.empty())
+  {
+    for (int i = 0; i < points.size(); ++i)
+    {
+      const auto& prev = chebyshev_before_last_[i];
+      const auto target = omega*(points[i]-prev) + prev;
+      DisplacePointAndUpdateVelocity(i, target-points[i], dt);
+    }
+  }
+  chebyshev_before_last_.swap(chebyshev_last_);
+  chebyshev_last_ = points;
+}
+
+void PbdSystem::UpdateFusedOrder()
+{
+  if (!fused_order_dirty_)
+    return;
+
+  // The sweep order of length_constraints_ is left alone, only the fused
+  // pass visits them by their highest particle index.
+  const auto last_point = [this](int k)
+  {
+    const auto& c = length_constraints_[k];
+    return std::max(c.idx1, c.idx2);
+  };
+  fused_order_.resize(length_constraints_.size());
+  for (int k = 0; k < fused_order_.size(); ++k)
+    fused_order_[k] = k;
+  std::stable_sort(fused_order_.begin(), fused_order_.end(),
+      [&](int a, int b) { return last_point(a) < last_point(b); });
+  fused_order_dirty_ = false;
+}
+
+void PbdSystem::IntegrateAndHandleLengthConstraints(Real dt)
+{
+  // Integration cannot be timed apart from the interleaved projections, so
+  // the whole pass is booked as length constraint work.
+  PBD_PROFILE_SCOPE(timer, LengthConstraints);
+  PBD_PROFILE_TESTED(timer, length_constraints_.size());
+  UpdateFusedOrder();
+  ResetLengthResiduals();
+  DispatchKernel([&](auto kernel)
+  {
+    IntegrateAndSweepLengthConstraints<decltype(kernel)>(dt);
+  });
+}
+
+template <typename Kernel>
+void PbdSystem::IntegrateAndSweepLengthConstraints(Real dt)
+{
+  // fused_order_ is sorted by highest particle index, so each constraint is
+  // projected right after both of its particles have been predicted.
+  const int num_points = GetNumPoints();
+  const int num_constraints = fused_order_.size();
+  int k = 0;
+  for (int i = 0; i < num_points; ++i)
+  {
+    IntegratePoint(i, dt);
+    for (; k < num_constraints; ++k)
+    {
+      const auto& c = length_constraints_[fused_order_[k]];
+      if (std::max(c.idx1, c.idx2) > i)
+        break;
+      ProjectLengthConstraint<Kernel>(c, dt);
+    }
+  }
+}
+
+void PbdSystem::DampVelocity(Real damping)
 {
   const auto momentum = GetMomentum();
   for (int i = 0; i < GetNumPoints(); ++i)
@@ -46,51 +282,307 @@ void PbdSystem::DampVelocity(double damping)
   }
 }
 
-void PbdSystem::HandleLengthConstraints(double dt)
+void PbdSystem::ReorderPoints(const std::vector<int>& new_to_old)
+{
+  PointCloud::ReorderPoints(new_to_old);
+
+  const auto old_to_new = InvertPermutation(new_to_old);
+  for (auto& c : length_constraints_)
+  {
+    c.idx1 = old_to_new[c.idx1];
+    c.idx2 = old_to_new[c.idx2];
+  }
+  fused_order_dirty_ = true;
+  chain_dirty_ = true;
+  for (auto& c : bend_constraints_)
+  {
+    c.idx1 = old_to_new[c.idx1];
+    c.idx2 = old_to_new[c.idx2];
+    c.idx3 = old_to_new[c.idx3];
+  }
+  for (auto& batch : constraint_batches_)
+  {
+    batch->RemapIndices(old_to_new);
+  }
+}
+
+void PbdSystem::HandleLengthConstraints(Real dt)
 {
-  for (const auto& c : length_constraints_)
+  PBD_PROFILE_SCOPE(timer, LengthConstraints);
+  PBD_PROFILE_TESTED(timer, length_constraints_.size());
+  ResetLengthResiduals();
+  if (direct_chain_solve_ && UpdateChain())
+  {
+    // The second solve removes the stretch added by links rotating during
+    // the first, which otherwise builds up over steps.
+    SolveLengthChain(dt);
+    ResetLengthResiduals();
+    SolveLengthChain(dt);
+    return;
+  }
+  DispatchKernel([&](auto kernel)
   {
-    for (int i = 0; i < c.num_iter; ++i)
+    for (const auto& c : length_constraints_)
     {
-      const auto p = GetPoint(c.idx1);
-      const auto q = GetPoint(c.idx2);
-      const auto pm = GetMass(c.idx1);
-      const auto qm = GetMass(c.idx2);
-      const auto target_len = c.target_len;
-      const auto stiffness = c.stiffness;
-      glm::dvec2 dp, dq;
-      GetLengthConstraintDelta(
-          p,pm,q,qm,target_len,stiffness,&dp,&dq);
-      DisplacePointAndUpdateVelocity(c.idx1, dp, dt);
-      DisplacePointAndUpdateVelocity(c.idx2, dq, dt);
+      ProjectLengthConstraint<decltype(kernel)>(c, dt);
     }
+  });
+}
+
+bool PbdSystem::UpdateChain()
+{
+  if (!chain_dirty_)
+    return !chain_links_.empty();
+
+  chain_dirty_ = false;
+  chain_points_.clear();
+  chain_links_.clear();
+
+  // Each particle may be shared by at most two constraints.
+  const int num_points = GetNumPoints();
+  std::vector<int> degree(num_points, 0);
+  std::vector<int> links(2*num_points, -1);
+  for (int k = 0; k < length_constraints_.size(); ++k)
+  {
+    for (const int idx : {length_constraints_[k].idx1,
+                          length_constraints_[k].idx2})
+    {
+      if (degree[idx] == 2)
+        return false;
+      links[2*idx + degree[idx]] = k;
+      degree[idx] += 1;
+    }
+  }
+
+  const auto start = std::find(degree.begin(), degree.end(), 1);
+  if (start == degree.end())
+    return false;
+
+  int idx = start - degree.begin();
+  int prev = -1;
+  chain_points_.push_back(idx);
+  while (true)
+  {
+    const int k = links[2*idx] != prev ? links[2*idx] : links[2*idx+1];
+    if (k == -1 || k == prev)
+      break;
+    const auto& c = length_constraints_[k];
+    idx = c.idx1 == idx ? c.idx2 : c.idx1;
+    prev = k;
+    chain_points_.push_back(idx);
+    chain_links_.push_back({c.target_len, c.stiffness});
   }
+
+  // A shorter walk means the constraints are split over several chains.
+  if (chain_links_.size() != length_constraints_.size())
+  {
+    chain_points_.clear();
+    chain_links_.clear();
+    return false;
+  }
+  return true;
 }
 
-void PbdSystem::HandleBendConstraints(double dt)
+void PbdSystem::SolveLengthChain(Real dt)
 {
+  // Linearizing C_j = |x_j+1 - x_j| - L_j around the current positions with
+  // corrections dx_k = w_k*(lambda_k-1*n_k-1 - lambda_k*n_k) gives a
+  // tridiagonal system in the multipliers lambda.
+  const int m = chain_links_.size();
+  chain_normals_.resize(m);
+  chain_lower_.resize(m);
+  chain_diag_.resize(m);
+  chain_upper_.resize(m);
+  chain_lambda_.resize(m);
+
+  for (int j = 0; j < m; ++j)
+  {
+    const auto u = GetPoint(chain_points_[j+1]) - GetPoint(chain_points_[j]);
+    const auto len = glm::length(u);
+    const auto C = len - chain_links_[j].target_len;
+    AddLengthResidual(C);
+    chain_normals_[j] = len > Real(1e-12) ? u/len : Vec2{0.0, 0.0};
+    chain_lambda_[j] = -C;
+  }
+
+  for (int j = 0; j < m; ++j)
+  {
+    const auto wp = 1/GetMass(chain_points_[j]);
+    const auto wq = 1/GetMass(chain_points_[j+1]);
+    // Links between two pinned particles get a dummy row.
+    chain_diag_[j] = wp + wq > 0 ? wp + wq : Real(1);
+    chain_lower_[j] = j > 0
+        ? -wp*glm::dot(chain_normals_[j-1], chain_normals_[j]) : Real(0);
+    chain_upper_[j] = j < m-1
+        ? -wq*glm::dot(chain_normals_[j], chain_normals_[j+1]) : Real(0);
+  }
+
+  SolveTridiagonal(chain_lower_, chain_diag_, &chain_upper_, &chain_lambda_);
+
+  for (int j = 0; j < m; ++j)
+  {
+    chain_lambda_[j] *= chain_links_[j].stiffness;
+  }
+
+  for (int k = 0; k <= m; ++k)
+  {
+    Vec2 dir{0.0, 0.0};
+    if (k > 0)
+      dir += chain_lambda_[k-1]*chain_normals_[k-1];
+    if (k < m)
+      dir -= chain_lambda_[k]*chain_normals_[k];
+    const auto dx = dir/GetMass(chain_points_[k]);
+    DisplacePointAndUpdateVelocity(chain_points_[k], dx, dt);
+    max_correction2_ = std::max(max_correction2_, glm::dot(dx,dx));
+  }
+}
+
+template <typename Kernel>
+void PbdSystem::ProjectLengthConstraint(const LengthConstraint& c, Real dt)
+{
+  using S = typename Kernel::Stiffness;
+  using M = typename Kernel::Mass;
+  using P = typename Kernel::Pinning;
+  const int num_iter = num_solver_iterations_ > 0 ? 1 : c.num_iter;
+  const int num_projections =
+      num_solver_iterations_ > 0 ? num_solver_iterations_ : c.num_iter;
+  for (int i = 0; i < num_iter; ++i)
+  {
+    const auto k = kernels::ProjectLength<S,M,P>(
+        GetPoint(c.idx1), GetMass(c.idx1),
+        GetPoint(c.idx2), GetMass(c.idx2),
+        c.target_len, c.stiffness, num_projections);
+    if (i == num_iter-1)
+    {
+      AddLengthResidual(k.C);
+    }
+    const auto omega = GetOverRelaxation();
+    const auto dp = omega*k.dp;
+    const auto dq = omega*k.dq;
+    DisplacePointAndUpdateVelocity(c.idx1, dp, dt);
+    DisplacePointAndUpdateVelocity(c.idx2, dq, dt);
+    max_correction2_ = std::max({max_correction2_,
+        glm::dot(dp,dp), glm::dot(dq,dq)});
+  }
+}
+
+void PbdSystem::HandleBendConstraints(Real dt)
+{
+  PBD_PROFILE_SCOPE(timer, BendConstraints);
+  PBD_PROFILE_TESTED(timer, bend_constraints_.size());
+  bend_errors_ = {};
+  DispatchKernel([&](auto kernel)
+  {
+    SweepBendConstraints<decltype(kernel)>(dt);
+  });
+}
+
+template <typename Kernel>
+void PbdSystem::SweepBendConstraints(Real dt)
+{
+  using S = typename Kernel::Stiffness;
+  using M = typename Kernel::Mass;
+  using P = typename Kernel::Pinning;
+  const auto omega = GetOverRelaxation();
   for (const auto& c : bend_constraints_)
   {
-    for (int i = 0; i < c.num_iter; ++i)
+    const int num_iter = num_solver_iterations_ > 0 ? 1 : c.num_iter;
+    const int num_projections =
+        num_solver_iterations_ > 0 ? num_solver_iterations_ : c.num_iter;
+    for (int i = 0; i < num_iter; ++i)
     {
-      const auto p = GetPoint(c.idx1);
-      const auto q = GetPoint(c.idx2);
-      const auto r = GetPoint(c.idx3);
-      const auto pm = GetMass(c.idx1);
-      const auto qm = GetMass(c.idx2);
-      const auto rm = GetMass(c.idx3);
-      const auto segment_length = c.segment_length;
-      const auto stiffness = c.stiffness;
-      glm::dvec2 dp, dq, dr;
-      GetBendConstraintDelta(
-          p,pm,q,qm,r,rm,
-          segment_length,stiffness,
-          &dp,&dq,&dr);
+      const auto k = kernels::ProjectBend<S,M,P>(
+          GetPoint(c.idx1), GetMass(c.idx1),
+          GetPoint(c.idx2), GetMass(c.idx2),
+          GetPoint(c.idx3), GetMass(c.idx3),
+          c.segment_length, c.stiffness, num_projections);
+      if (i == num_iter-1)
+      {
+        bend_errors_.max = std::max(bend_errors_.max, std::sqrt(k.C));
+        bend_errors_.sum2 += k.C;
+        bend_errors_.count += 1;
+      }
+      const auto dp = omega*k.dp;
+      const auto dq = omega*k.dq;
+      const auto dr = omega*k.dr;
       DisplacePointAndUpdateVelocity(c.idx1, dp, dt);
       DisplacePointAndUpdateVelocity(c.idx2, dq, dt);
       DisplacePointAndUpdateVelocity(c.idx3, dr, dt);
+      max_correction2_ = std::max({max_correction2_,
+          glm::dot(dp,dp), glm::dot(dq,dq), glm::dot(dr,dr)});
+    }
+  }
+}
+
+void PbdSystem::HandleCustomConstraints(Real dt)
+{
+  if (constraint_batches_.empty())
+    return;
+
+  PBD_PROFILE_SCOPE(timer, CustomConstraints);
+  ConstraintContext ctx{this, dt, std::max(num_solver_iterations_, 1),
+                        GetOverRelaxation(), max_correction2_};
+  for (const auto& batch : constraint_batches_)
+  {
+    PBD_PROFILE_TESTED(timer, batch->GetSize());
+    batch->Project(ctx);
+  }
+  max_correction2_ = ctx.max_correction2;
+}
+
+void PbdSystem::UpdateMassModel()
+{
+  if (GetMassRevision() == mass_model_revision_)
+    return;
+
+  mass_model_revision_ = GetMassRevision();
+  has_pinned_points_ = false;
+  uniform_mass_ = true;
+  Real first_mass = 0;
+  for (int i = 0; i < GetNumPoints(); ++i)
+  {
+    const auto m = GetMass(i);
+    if (std::isinf(m))
+    {
+      has_pinned_points_ = true;
+      continue;
+    }
+    if (first_mass == 0)
+    {
+      first_mass = m;
     }
+    uniform_mass_ = uniform_mass_ && m == first_mass;
   }
 }
 
+template <typename Stiffness, typename F>
+void PbdSystem::DispatchMassModel(F&& f)
+{
+  using namespace kernels;
+  if (has_pinned_points_)
+  {
+    if (uniform_mass_)
+      f(Kernel<Stiffness, UniformMass, InfiniteMassPinning>{});
+    else
+      f(Kernel<Stiffness, PerParticleMass, InfiniteMassPinning>{});
+  }
+  else
+  {
+    if (uniform_mass_)
+      f(Kernel<Stiffness, UniformMass, NoPinning>{});
+    else
+      f(Kernel<Stiffness, PerParticleMass, NoPinning>{});
+  }
+}
+
+template <typename F>
+void PbdSystem::DispatchKernel(F&& f)
+{
+  UpdateMassModel();
+  if (stiffness_model_ == StiffnessModel::IterationIndependent)
+    DispatchMassModel<kernels::IterationIndependentStiffness>(f);
+  else
+    DispatchMassModel<kernels::LinearStiffness>(f);
+}
+
 }
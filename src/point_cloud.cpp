@@ -1,4 +1,8 @@
 #include "point_cloud.hpp"
+#include "profiler.hpp"
+
+using pbd::Real;
+using pbd::Vec2;
 
 PointCloud::PointCloud(int num_points)
   : num_points_(num_points)
@@ -21,29 +25,44 @@ PointCloud::PointCloud(int num_points)
   points_from_prev_timestep_ = points_;
 }
 
-void PointCloud::Integrate(double dt)
+void PointCloud::Integrate(Real dt)
 {
-  points_from_prev_timestep_ = points_;
+  PBD_PROFILE_SCOPE(timer, Integrate);
+  PBD_PROFILE_TESTED(timer, num_points_);
   for (int i = 0; i < num_points_; ++i)
   {
-    velocities_[i] += forces_[i]*dt/masses_[i] + gravity_*dt;
-    points_[i] += velocities_[i]*dt;
+    IntegratePoint(i, dt);
   }
 }
 
-void PointCloud::DisplacePoint(int i, glm::dvec2 d)
+void PointCloud::DisplacePoint(int i, Vec2 d)
 {
   points_[i] += d;
 }
 
 void PointCloud::DisplacePointAndUpdateVelocity(
-    int i, glm::dvec2 d, double dt)
+    int i, Vec2 d, Real dt)
 {
   points_[i] += d;
-  velocities_[i] += d/dt;
+  if (velocity_update_ == VelocityUpdate::PerCorrection)
+  {
+    velocities_[i] += d/dt;
+  }
+}
+
+void PointCloud::UpdateVelocities(Real dt)
+{
+  if (velocity_update_ != VelocityUpdate::FromPositions)
+    return;
+
+  const Real inv_dt = 1/dt;
+  for (int i = 0; i < num_points_; ++i)
+  {
+    velocities_[i] = (points_[i] - points_from_prev_timestep_[i])*inv_dt;
+  }
 }
 
-void PointCloud::DisplaceCloud(glm::dvec2 d)
+void PointCloud::DisplaceCloud(Vec2 d)
 {
   for (int i = 0; i < num_points_; ++i)
   {
@@ -51,22 +70,22 @@ void PointCloud::DisplaceCloud(glm::dvec2 d)
   }
 }
 
-void PointCloud::AddVelocity(int i, glm::dvec2 v)
+void PointCloud::AddVelocity(int i, Vec2 v)
 {
   velocities_[i] += v;
 }
 
-void PointCloud::AddForce(int i, glm::dvec2 F)
+void PointCloud::AddForce(int i, Vec2 F)
 {
   forces_[i] += F;
 }
 
-void PointCloud::SetGravity(glm::dvec2 g)
+void PointCloud::SetGravity(Vec2 g)
 {
   gravity_ = g;
 }
 
-void PointCloud::SpawnNewPoints(std::vector<glm::dvec2> v)
+void PointCloud::SpawnNewPoints(std::vector<Vec2> v)
 {
   points_ = v;
   points_from_prev_timestep_ = v;
@@ -75,6 +94,7 @@ void PointCloud::SpawnNewPoints(std::vector<glm::dvec2> v)
   velocities_.resize(num_points_);
   forces_.resize(num_points_);
   masses_.resize(num_points_);
+  mass_revision_ += 1;
   radii_.resize(num_points_);
 
   for (int i = 0; i < num_points_; ++i)
@@ -94,73 +114,104 @@ void PointCloud::RemoveAllPoints()
   velocities_.resize(0);
   forces_.resize(0);
   masses_.resize(0);
+  mass_revision_ += 1;
   radii_.resize(0);
 }
 
+namespace
+{
+
+template <typename T>
+void Permute(std::vector<T>* v, const std::vector<int>& new_to_old)
+{
+  std::vector<T> permuted(v->size());
+  for (int i = 0; i < new_to_old.size(); ++i)
+    permuted[i] = (*v)[new_to_old[i]];
+  v->swap(permuted);
+}
+
+}
+
+void PointCloud::ReorderPoints(const std::vector<int>& new_to_old)
+{
+  Permute(&points_, new_to_old);
+  Permute(&points_from_prev_timestep_, new_to_old);
+  Permute(&velocities_, new_to_old);
+  Permute(&forces_, new_to_old);
+  Permute(&masses_, new_to_old);
+  Permute(&radii_, new_to_old);
+}
+
 //setters & getters
 int PointCloud::GetNumPoints() const
 {
   return num_points_;
 }
 
-std::vector<glm::dvec2> PointCloud::GetPoints() const
+const std::vector<Vec2>& PointCloud::GetPoints() const
 {
   return points_;
 }
 
-glm::dvec2 PointCloud::GetPoint(int i) const
+Vec2 PointCloud::GetPoint(int i) const
 {
   return points_[i];
 }
 
-glm::dvec2 PointCloud::GetPointFromPreviousTimestep(int i) const
+Vec2 PointCloud::GetPointFromPreviousTimestep(int i) const
 {
   return points_from_prev_timestep_[i];
 }
 
-void PointCloud::SetPoint(int i, glm::dvec2 p)
+void PointCloud::SetPoint(int i, Vec2 p)
 {
   points_[i] = p;
 }
 
-glm::dvec2 PointCloud::GetVelocity(int i) const
+Vec2 PointCloud::GetVelocity(int i) const
 {
   return velocities_[i];
 }
 
-void PointCloud::SetVelocity(int i, glm::dvec2 v)
+void PointCloud::SetVelocity(int i, Vec2 v)
 {
   velocities_[i] = v;
 }
 
-void PointCloud::SetMass(int i, double m)
+void PointCloud::SetMass(int i, Real m)
 {
   masses_[i] = m;
+  mass_revision_ += 1;
 }
 
-double PointCloud::GetMass(int i) const
+Real PointCloud::GetMass(int i) const
 {
   return masses_[i];
 }
 
-void PointCloud::SetRadii(double r)
+void PointCloud::SetRadii(Real r)
 {
   std::fill(radii_.begin(), radii_.end(), r);
 }
 
-double PointCloud::GetRadius(int i) const
+Real PointCloud::GetRadius(int i) const
 {
   return radii_[i];
 }
 
-void PointCloud::SetForce(int i, glm::dvec2 F)
+void PointCloud::SetForce(int i, Vec2 F)
 {
   forces_[i] = F;
 }
 
-glm::dvec2 PointCloud::GetCenterOfMass() const
+void PointCloud::SetVelocityUpdate(VelocityUpdate mode)
+{
+  velocity_update_ = mode;
+}
+
+Vec2 PointCloud::GetCenterOfMass() const
 {
-  glm::dvec2 center_of_mass{0.0,0.0};
+  Vec2 center_of_mass{0.0,0.0};
 
   for (int i = 0; i < num_points_; ++i)
   {
@@ -171,9 +222,25 @@ glm::dvec2 PointCloud::GetCenterOfMass() const
   return center_of_mass;
 }
 
-glm::dvec2 PointCloud::GetMomentum() const
+geometry::Rect PointCloud::GetBoundingBox() const
+{
+  if (num_points_ == 0)
+    return {0.0, 0.0, 0.0, 0.0};
+
+  Vec2 lo = points_[0];
+  Vec2 hi = points_[0];
+  for (int i = 1; i < num_points_; ++i)
+  {
+    lo = glm::min(lo, points_[i]);
+    hi = glm::max(hi, points_[i]);
+  }
+
+  return {lo.x, hi.x, lo.y, hi.y};
+}
+
+Vec2 PointCloud::GetMomentum() const
 {
-  glm::dvec2 momentum{0.0,0.0};
+  Vec2 momentum{0.0,0.0};
 
   for (int i = 0; i < num_points_; ++i)
     momentum += velocities_[i];
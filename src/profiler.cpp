@@ -0,0 +1,205 @@
+#include "profiler.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+
+namespace pbd
+{
+namespace profiler
+{
+
+namespace
+{
+
+constexpr int kNumStages = static_cast<int>(Stage::NumStages);
+constexpr uint64_t kCapacity = 4096;
+
+// Each slot is guarded by a sequence number: odd while being written, and
+// 2*(n+1) once it holds the n:th recorded sample. All fields are atomics so
+// a reader racing the writer sees a torn slot only through the sequence.
+struct Slot
+{
+  std::atomic<uint64_t> seq{0};
+  std::atomic<int> stage{0};
+  std::atomic<int64_t> start_ns{0};
+  std::atomic<int64_t> duration_ns{0};
+  std::atomic<int64_t> num_tested{0};
+  std::atomic<int64_t> num_hits{0};
+};
+
+std::array<Slot, kCapacity> slots;
+std::atomic<uint64_t> head{0};
+std::atomic<uint64_t> tail{0};
+
+struct Accumulator
+{
+  int64_t start_ns;
+  int64_t duration_ns;
+  int64_t num_tested;
+  int64_t num_hits;
+  bool active;
+};
+
+thread_local std::array<Accumulator, kNumStages> accumulators{};
+
+}
+
+const char* GetStageName(Stage stage)
+{
+  switch (stage)
+  {
+    case Stage::Step:
+      return "Step";
+    case Stage::Integrate:
+      return "Integrate";
+    case Stage::LengthConstraints:
+      return "LengthConstraints";
+    case Stage::BendConstraints:
+      return "BendConstraints";
+    case Stage::PointLineSegCollisions:
+      return "PointLineSegCollisions";
+    case Stage::HalfPlaneCollisions:
+      return "HalfPlaneCollisions";
+    case Stage::PolygonPointCollisions:
+      return "PolygonPointCollisions";
+    case Stage::CustomConstraints:
+      return "CustomConstraints";
+    case Stage::RigidBodyCollisions:
+      return "RigidBodyCollisions";
+    case Stage::PolygonPolygonCollisions:
+      return "PolygonPolygonCollisions";
+    case Stage::SelfCollisions:
+      return "SelfCollisions";
+    default:
+      return "Unknown";
+  }
+}
+
+int64_t NowNs()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(
+      steady_clock::now().time_since_epoch()).count();
+}
+
+void Record(const Sample& sample)
+{
+  const auto n = head.load(std::memory_order_relaxed);
+  auto& slot = slots[n % kCapacity];
+
+  slot.seq.store(2*n+1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.stage.store(static_cast<int>(sample.stage), std::memory_order_relaxed);
+  slot.start_ns.store(sample.start_ns, std::memory_order_relaxed);
+  slot.duration_ns.store(sample.duration_ns, std::memory_order_relaxed);
+  slot.num_tested.store(sample.num_tested, std::memory_order_relaxed);
+  slot.num_hits.store(sample.num_hits, std::memory_order_relaxed);
+  slot.seq.store(2*(n+1), std::memory_order_release);
+
+  head.store(n+1, std::memory_order_release);
+}
+
+std::vector<Sample> GetSamples()
+{
+  const auto end = head.load(std::memory_order_acquire);
+  auto begin = tail.load(std::memory_order_acquire);
+  if (end - begin > kCapacity)
+    begin = end - kCapacity;
+
+  std::vector<Sample> samples;
+  samples.reserve(end-begin);
+  for (auto n = begin; n < end; ++n)
+  {
+    const auto& slot = slots[n % kCapacity];
+    const auto seq = slot.seq.load(std::memory_order_acquire);
+    Sample s;
+    s.stage = static_cast<Stage>(slot.stage.load(std::memory_order_relaxed));
+    s.start_ns = slot.start_ns.load(std::memory_order_relaxed);
+    s.duration_ns = slot.duration_ns.load(std::memory_order_relaxed);
+    s.num_tested = slot.num_tested.load(std::memory_order_relaxed);
+    s.num_hits = slot.num_hits.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // Skip slots that were overwritten while we were copying them.
+    if (seq != 2*(n+1) || slot.seq.load(std::memory_order_relaxed) != seq)
+      continue;
+
+    samples.push_back(s);
+  }
+
+  return samples;
+}
+
+void Clear()
+{
+  tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+void WriteChromeTrace(std::ostream& os)
+{
+  const auto samples = GetSamples();
+  const auto flags = os.flags();
+  const auto precision = os.precision();
+
+  os << std::fixed << std::setprecision(3);
+  os << "{\"traceEvents\":[";
+  for (int i = 0; i < samples.size(); ++i)
+  {
+    const auto& s = samples[i];
+    if (i > 0)
+      os << ",";
+
+    // One track per stage, since nested stage totals overlap in time.
+    os << "{\"name\":\"" << GetStageName(s.stage) << "\""
+       << ",\"ph\":\"X\",\"pid\":0"
+       << ",\"tid\":" << static_cast<int>(s.stage)
+       << ",\"ts\":" << s.start_ns/1000.0
+       << ",\"dur\":" << s.duration_ns/1000.0
+       << ",\"args\":{\"tested\":" << s.num_tested
+       << ",\"hits\":" << s.num_hits << "}}";
+  }
+  os << "]}\n";
+
+  os.flags(flags);
+  os.precision(precision);
+}
+
+ScopedTimer::ScopedTimer(Stage stage)
+  : stage_(stage)
+  , start_ns_(NowNs())
+{
+}
+
+ScopedTimer::~ScopedTimer()
+{
+  const auto end_ns = NowNs();
+
+  if (stage_ != Stage::Step)
+  {
+    auto& acc = accumulators[static_cast<int>(stage_)];
+    if (!acc.active)
+    {
+      acc = {start_ns_, 0, 0, 0, true};
+    }
+    acc.duration_ns += end_ns - start_ns_;
+    acc.num_tested += num_tested_;
+    acc.num_hits += num_hits_;
+    return;
+  }
+
+  Record({stage_, start_ns_, end_ns - start_ns_, num_tested_, num_hits_});
+  for (int i = 0; i < kNumStages; ++i)
+  {
+    auto& acc = accumulators[i];
+    if (!acc.active)
+      continue;
+    Record({static_cast<Stage>(i),
+            acc.start_ns, acc.duration_ns, acc.num_tested, acc.num_hits});
+    acc.active = false;
+  }
+}
+
+}
+}
@@ -0,0 +1,131 @@
+#include "rigid_body.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace pbd
+{
+
+namespace
+{
+
+Vec2 Rotate(Vec2 v, Real angle)
+{
+  const auto c = std::cos(angle);
+  const auto s = std::sin(angle);
+  return {c*v.x - s*v.y, s*v.x + c*v.y};
+}
+
+Real Cross(Vec2 u, Vec2 v)
+{
+  return u.x*v.y - u.y*v.x;
+}
+
+}
+
+RigidBody::RigidBody(std::vector<Vec2> vertices, Real mass)
+  : vertices_(std::move(vertices))
+{
+  // Area, centroid and polar moment of the polygon from its triangle fan.
+  const int n = vertices_.size();
+  Real area = 0;
+  Vec2 centroid{0.0, 0.0};
+  for (int i = 0; i < n; ++i)
+  {
+    const auto& p = vertices_[i];
+    const auto& q = vertices_[(i+1)%n];
+    const auto a = Cross(p, q)/2;
+    area += a;
+    centroid += a*(p+q)/Real(3);
+  }
+  centroid /= area;
+
+  Real moment = 0;
+  for (auto& v : vertices_)
+  {
+    v -= centroid;
+  }
+  for (int i = 0; i < n; ++i)
+  {
+    const auto& p = vertices_[i];
+    const auto& q = vertices_[(i+1)%n];
+    moment += Cross(p, q)*(glm::dot(p,p) + glm::dot(p,q) + glm::dot(q,q));
+  }
+  const auto density = mass/area;
+  const auto inertia = density*moment/12;
+
+  position_ = prev_position_ = centroid;
+  inverse_mass_ = 1/mass;
+  inverse_inertia_ = 1/inertia;
+}
+
+void RigidBody::Integrate(Real dt)
+{
+  prev_position_ = position_;
+  prev_angle_ = angle_;
+  velocity_ += gravity_*dt;
+  position_ += velocity_*dt;
+  angle_ += angular_velocity_*dt;
+}
+
+void RigidBody::UpdateVelocities(Real dt)
+{
+  velocity_ = (position_ - prev_position_)/dt;
+  angular_velocity_ = (angle_ - prev_angle_)/dt;
+}
+
+void RigidBody::ApplyPositionImpulse(Vec2 impulse, Vec2 p)
+{
+  angle_ += Cross(p - position_, impulse)*inverse_inertia_;
+  position_ += impulse*inverse_mass_;
+}
+
+Real RigidBody::GetGeneralizedInverseMass(Vec2 p, Vec2 n) const
+{
+  const auto rn = Cross(p - position_, n);
+  return inverse_mass_ + rn*rn*inverse_inertia_;
+}
+
+Vec2 RigidBody::GetPreviousPosition(Vec2 p) const
+{
+  const auto local = Rotate(p - position_, -angle_);
+  return prev_position_ + Rotate(local, prev_angle_);
+}
+
+const std::vector<Vec2>& RigidBody::GetWorldVertices() const
+{
+  world_vertices_.resize(vertices_.size());
+  const auto c = std::cos(angle_);
+  const auto s = std::sin(angle_);
+  for (int i = 0; i < vertices_.size(); ++i)
+  {
+    const auto& v = vertices_[i];
+    world_vertices_[i] = position_ + Vec2{c*v.x - s*v.y, s*v.x + c*v.y};
+  }
+  return world_vertices_;
+}
+
+geometry::Rect RigidBody::GetBoundingBox() const
+{
+  const auto& vertices = GetWorldVertices();
+  geometry::Rect box{vertices[0].x, vertices[0].x,
+                     vertices[0].y, vertices[0].y};
+  for (const auto& v : vertices)
+  {
+    box.x1 = std::min(box.x1, v.x);
+    box.x2 = std::max(box.x2, v.x);
+    box.y1 = std::min(box.y1, v.y);
+    box.y2 = std::max(box.y2, v.y);
+  }
+  return box;
+}
+
+RigidBody MakeRigidBox(Real width, Real height, Real mass)
+{
+  const auto w = width/2;
+  const auto h = height/2;
+  return RigidBody({{-w, -h}, {w, -h}, {w, h}, {-w, h}}, mass);
+}
+
+}
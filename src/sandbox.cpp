@@ -7,13 +7,18 @@
 #include "pbd_system.hpp"
 #include "pbd_factory.hpp"
 #include "collisions.hpp"
+#include "morton.hpp"
+#include "profiler.hpp"
 
 #include <SDL2/SDL.h>
 #include <glm/gtc/constants.hpp>
 #include <glm/gtx/norm.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
+#include <iterator>
 #include <sstream>
 #include <limits>
 
@@ -32,7 +37,10 @@ Sandbox::Sandbox()
   collisions_.AddHalfPlane(normal, center, friction_coeff);
 }
 
-Sandbox::~Sandbox() {}
+Sandbox::~Sandbox()
+{
+  SetThreadedPhysics(false);
+}
 
 void Sandbox::Quit()
 {
@@ -46,70 +54,417 @@ bool Sandbox::IsRunning() const
 
 void Sandbox::UpdateDynamics(double dt)
 {
-  auto cur_phys_time = time_accumulator_;
-  time_accumulator_ += dt;
+  frame_times_[frame_count_ % kFrameHistoryLength] = dt;
+  frame_count_ += 1;
 
   camera_->Displace(GetPanDirection()*dt);
 
-  while (cur_phys_time < time_accumulator_)
+  if (!IsPhysicsThreaded())
   {
-    for (auto& pbd : pbds_)
-      pbd->Integrate(physics_dt_);
+    auto cur_phys_time = time_accumulator_;
+    time_accumulator_ += dt;
+
+    while (cur_phys_time < time_accumulator_)
+    {
+      Step(physics_dt_);
+      cur_phys_time += physics_dt_;
+    }
+
+    PublishSnapshot();
+  }
+
+  snapshots_.Acquire();
+  const auto step_count = GetSnapshot().step_count;
+  num_substeps_last_frame_ = step_count - last_snapshot_step_count_;
+  last_snapshot_step_count_ = step_count;
+}
+
+void Sandbox::Step(double dt)
+{
+  PBD_PROFILE_SCOPE(timer, Step);
+
+  if (reorder_interval_ > 0 && substep_count_ % reorder_interval_ == 0)
+  {
+    ReorderParticles();
+  }
+
+  for (auto& pbd : pbds_)
+    pbd->Integrate(dt);
+  for (auto& body : rigid_bodies_)
+    body->Integrate(dt);
+
+  collisions_.ResolveCollisions(dt);
+
+  if (dragging_)
+  {
+    DragSelections(dt);
+  }
 
-    collisions_.ResolveCollisions(physics_dt_);
+  for (auto& pbd : pbds_)
+    pbd->UpdateVelocities(dt);
+  for (auto& body : rigid_bodies_)
+    body->UpdateVelocities(dt);
 
-    for (const auto& sel : selections_)
+  if (!force_fields_.IsEmpty())
+  {
+    force_fields_.Apply(&collisions_);
+  }
+
+  substep_count_ += 1;
+}
+
+void Sandbox::PublishSnapshot()
+{
+  auto& snapshot = snapshots_.GetWriteBuffer();
+
+  snapshot.bodies.resize(pbds_.size());
+  snapshot.max_length_error = 0.0;
+  snapshot.max_bend_error = 0.0;
+  snapshot.num_solver_iterations = 0;
+  for (int i = 0; i < pbds_.size(); ++i)
+  {
+    const auto& pbd = pbds_[i];
+    auto& body = snapshot.bodies[i];
+    body.points = pbd->GetPoints();
+    body.bounding_box = pbd->GetBoundingBox();
+    body.num_constraints = pbd->GetNumConstraints();
+
+    const auto& residuals = pbd->GetResiduals();
+    snapshot.max_length_error =
+        glm::max(snapshot.max_length_error, residuals.max_length_error);
+    snapshot.max_bend_error =
+        glm::max(snapshot.max_bend_error, residuals.max_bend_error);
+    snapshot.num_solver_iterations =
+        glm::max(snapshot.num_solver_iterations, residuals.num_iterations);
+  }
+
+  snapshot.rigid_bodies.resize(rigid_bodies_.size());
+  for (int i = 0; i < rigid_bodies_.size(); ++i)
+  {
+    const auto& vertices = rigid_bodies_[i]->GetWorldVertices();
+    snapshot.rigid_bodies[i].assign(vertices.begin(), vertices.end());
+  }
+
+  snapshot.selected_points.clear();
+  for (int i = 0; i < selections_.size(); ++i)
+  {
+    for (const int idx : selections_[i].indices)
     {
-      const int pbd_idx = sel.first.first;
-      const int point_idx = sel.first.second;
-      const auto p = pbds_[pbd_idx]->GetPoint(point_idx);
-      const auto d = attractor_point_ - p;
-      pbds_[pbd_idx]->DisplacePointAndUpdateVelocity(
-          point_idx, d, physics_dt_);
+      snapshot.selected_points.push_back(pbds_[i]->GetPoint(idx));
     }
+  }
+
+  const auto& stats = collisions_.GetStats();
+  snapshot.num_contacts = stats.num_contacts;
+  snapshot.max_penetration = stats.max_penetration;
+  snapshot.step_count = substep_count_;
+  snapshots_.Publish();
+}
+
+void Sandbox::SetThreadedPhysics(bool on)
+{
+  if (on && !IsPhysicsThreaded())
+  {
+    physics_thread_running_ = true;
+    physics_thread_ = std::thread(&Sandbox::PhysicsThreadLoop, this);
+  }
+  else if (!on && IsPhysicsThreaded())
+  {
+    physics_thread_running_ = false;
+    physics_thread_.join();
+    RunCommands();
+  }
+}
+
+void Sandbox::PhysicsThreadLoop()
+{
+  using Clock = std::chrono::steady_clock;
+  const auto period = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(physics_dt_));
+  const int max_lag_steps = 10;
 
-    if (repel_)
+  auto next_step = Clock::now();
+  while (physics_thread_running_)
+  {
+    RunCommands();
+    Step(physics_dt_);
+    PublishSnapshot();
+
+    // Drop time we cannot catch up with instead of spiralling.
+    next_step += period;
+    const auto now = Clock::now();
+    if (next_step < now - max_lag_steps*period)
     {
-      SetRepellerForces();
+      next_step = now;
     }
+    std::this_thread::sleep_until(next_step);
+  }
+}
 
-    cur_phys_time += physics_dt_;
+void Sandbox::Post(std::function<void()> command)
+{
+  if (!IsPhysicsThreaded())
+  {
+    command();
+    return;
   }
 
+  std::lock_guard<std::mutex> lock(command_mutex_);
+  commands_.push_back(std::move(command));
 }
 
-glm::dvec2 Sandbox::GetPoint(int pbd_idx, int point_idx) const
+void Sandbox::RunCommands()
 {
-  return pbds_[pbd_idx]->GetPoint(point_idx);
+  std::vector<std::function<void()>> commands;
+  {
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    commands.swap(commands_);
+  }
+
+  for (const auto& command : commands)
+  {
+    command();
+  }
+}
+
+void Sandbox::SetReorderInterval(int num_substeps)
+{
+  Post([this, num_substeps]()
+  {
+    reorder_interval_ = num_substeps;
+  });
 }
 
-void Sandbox::SelectPoint(int pbd_idx, int point_idx, Selection type)
+void Sandbox::ReorderParticles()
 {
-  std::pair<int,int> key{pbd_idx, point_idx};
-  if (selections_.count(key))
+  for (int pbd_idx = 0; pbd_idx < pbds_.size(); ++pbd_idx)
   {
-    selections_.erase(key);
+    auto& pbd = pbds_[pbd_idx];
+    const auto new_to_old = pbd::ComputeMortonOrder(pbd->GetPoints());
+    const auto old_to_new = pbd::InvertPermutation(new_to_old);
+    pbd->ReorderPoints(new_to_old);
+    collisions_.RemapPointCloud(pbd.get(), old_to_new);
+
+    auto& sel = selections_[pbd_idx];
+    std::vector<std::pair<int,glm::dvec2>> remapped;
+    for (int k = 0; k < sel.indices.size(); ++k)
+    {
+      remapped.push_back({old_to_new[sel.indices[k]], sel.offsets[k]});
+    }
+    std::sort(remapped.begin(), remapped.end(),
+        [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (int k = 0; k < remapped.size(); ++k)
+    {
+      sel.indices[k] = remapped[k].first;
+      sel.offsets[k] = remapped[k].second;
+    }
   }
-  else
+}
+
+void Sandbox::DragSelections(double dt)
+{
+  for (int pbd_idx = 0; pbd_idx < selections_.size(); ++pbd_idx)
   {
-    const double inf = std::numeric_limits<double>::max();
-    selections_.emplace(std::pair<int,int>{pbd_idx, point_idx}, type);
+    const auto& sel = selections_[pbd_idx];
+    auto pbd = pbds_[pbd_idx].get();
+    const int n = sel.indices.size();
+    for (int k = 0; k < n; ++k)
+    {
+      const int idx = sel.indices[k];
+      const auto d = attractor_point_ + sel.offsets[k] - pbd->GetPoint(idx);
+      pbd->DisplacePointAndUpdateVelocity(idx, d, dt);
+    }
   }
 }
 
+glm::dvec2 Sandbox::GetPoint(int pbd_idx, int point_idx) const
+{
+  return pbds_[pbd_idx]->GetPoint(point_idx);
+}
+
+void Sandbox::SelectPoint(int pbd_idx, int point_idx)
+{
+  Post([this, pbd_idx, point_idx]()
+  {
+    auto& sel = selections_[pbd_idx];
+    const auto it = std::lower_bound(
+        sel.indices.begin(), sel.indices.end(), point_idx);
+    const auto k = it - sel.indices.begin();
+    if (it != sel.indices.end() && *it == point_idx)
+    {
+      sel.indices.erase(it);
+      sel.offsets.erase(sel.offsets.begin() + k);
+    }
+    else
+    {
+      sel.indices.insert(it, point_idx);
+      sel.offsets.insert(sel.offsets.begin() + k, {0.0, 0.0});
+    }
+  });
+}
+
+void Sandbox::SelectNearestPoint(glm::dvec2 p, double radius)
+{
+  Post([this, p, radius]()
+  {
+    pbd::collisions::Point nearest;
+    if (!collisions_.FindNearestPoint(p, radius, &nearest))
+      return;
+
+    for (int pbd_idx = 0; pbd_idx < pbds_.size(); ++pbd_idx)
+    {
+      if (pbds_[pbd_idx].get() != nearest.pc)
+        continue;
+
+      auto& sel = selections_[pbd_idx];
+      const auto it = std::lower_bound(
+          sel.indices.begin(), sel.indices.end(), nearest.idx);
+      if (it == sel.indices.end() || *it != nearest.idx)
+      {
+        sel.offsets.insert(
+            sel.offsets.begin() + (it - sel.indices.begin()), {0.0, 0.0});
+        sel.indices.insert(it, nearest.idx);
+      }
+      dragging_ = true;
+      return;
+    }
+  });
+}
+
+void Sandbox::SelectRegion(std::vector<glm::dvec2> polygon)
+{
+  Post([this, polygon]()
+  {
+    if (polygon.size() < 3)
+      return;
+
+    geometry::Rect bounds{polygon[0].x, polygon[0].x,
+                          polygon[0].y, polygon[0].y};
+    for (const auto& v : polygon)
+    {
+      bounds = {glm::min(bounds.x1, v.x), glm::max(bounds.x2, v.x),
+                glm::min(bounds.y1, v.y), glm::max(bounds.y2, v.y)};
+    }
+
+    std::vector<int> inside;
+    std::vector<int> merged;
+    for (int pbd_idx = 0; pbd_idx < pbds_.size(); ++pbd_idx)
+    {
+      const auto& pbd = pbds_[pbd_idx];
+      if (!geometry::RectsOverlap(pbd->GetBoundingBox(), bounds))
+        continue;
+
+      inside.clear();
+      const auto& points = pbd->GetPoints();
+      for (int i = 0; i < points.size(); ++i)
+      {
+        if (geometry::RectContainsPoint(bounds, points[i]) &&
+            geometry::PointInPolygon(points[i], polygon))
+        {
+          inside.push_back(i);
+        }
+      }
+
+      if (inside.empty())
+        continue;
+
+      auto& sel = selections_[pbd_idx];
+      merged.clear();
+      std::set_union(sel.indices.begin(), sel.indices.end(),
+                     inside.begin(), inside.end(),
+                     std::back_inserter(merged));
+      sel.indices.swap(merged);
+      sel.offsets.assign(sel.indices.size(), {0.0, 0.0});
+    }
+  });
+}
+
+void Sandbox::GrabSelection(glm::dvec2 p)
+{
+  Post([this, p]()
+  {
+    attractor_point_ = p;
+    for (int pbd_idx = 0; pbd_idx < selections_.size(); ++pbd_idx)
+    {
+      auto& sel = selections_[pbd_idx];
+      for (int k = 0; k < sel.indices.size(); ++k)
+      {
+        sel.offsets[k] = pbds_[pbd_idx]->GetPoint(sel.indices[k]) - p;
+      }
+    }
+    dragging_ = true;
+  });
+}
+
 void Sandbox::DeselectAll()
 {
-  selections_.clear();
+  Post([this]()
+  {
+    for (auto& sel : selections_)
+    {
+      sel.indices.clear();
+      sel.offsets.clear();
+    }
+    dragging_ = false;
+  });
+}
+
+void Sandbox::BeginRegionSelection(RegionMode mode, glm::dvec2 p)
+{
+  selecting_region_ = true;
+  region_mode_ = mode;
+  region_points_ = {p, p};
+}
+
+void Sandbox::ExtendRegionSelection(glm::dvec2 p)
+{
+  if (!selecting_region_)
+    return;
+
+  if (region_mode_ == RegionMode::Box)
+    region_points_.back() = p;
+  else
+    region_points_.push_back(p);
+}
+
+void Sandbox::EndRegionSelection()
+{
+  if (!selecting_region_)
+    return;
+
+  SelectRegion(GetRegionOutline());
+  selecting_region_ = false;
+  region_points_.clear();
+}
+
+std::vector<glm::dvec2> Sandbox::GetRegionOutline() const
+{
+  if (!selecting_region_ || region_mode_ == RegionMode::Lasso)
+    return region_points_;
+
+  const auto a = region_points_.front();
+  const auto b = region_points_.back();
+  return {a, {b.x, a.y}, b, {a.x, b.y}};
 }
 
 void Sandbox::SetAttractorPoint(glm::dvec2 p)
 {
-  attractor_point_ = p;
+  Post([this, p]()
+  {
+    attractor_point_ = p;
+  });
 }
 
 void Sandbox::SetRepellerPoint(glm::dvec2 p)
 {
-  repeller_point_ = p;
+  Post([this, p]()
+  {
+    repeller_point_ = p;
+    if (auto field = force_fields_.GetField(repeller_field_))
+    {
+      field->center = p;
+    }
+  });
 }
 
 void Sandbox::Pan(Direction d, bool onoff)
@@ -152,61 +507,118 @@ glm::dvec2 Sandbox::GetPanDirection()
 
 void Sandbox::SpawnSquare(glm::dvec2 pos)
 {
-  const double stiffness = 0.4;
-  const double side_length = 0.1;
-  pbds_.push_back(pbd::MakeSquare(side_length, stiffness));
-  const auto p = pbds_.back()->GetPoint(0);
-  pbds_.back()->DisplaceCloud(pos-p);
-  pbds_.back()->SetGravity({0,-9.82});
-  pbds_.back()->SetRadii(point_radius_);
-  collisions_.AddPointCloud(pbds_.back().get());
+  Post([this, pos]()
+  {
+    const double stiffness = 0.4;
+    const double side_length = 0.1;
+    pbds_.push_back(pbd::MakeSquare(side_length, stiffness));
+    const auto p = pbds_.back()->GetPoint(0);
+    pbds_.back()->DisplaceCloud(pos-p);
+    pbds_.back()->SetGravity({0,-9.82});
+    pbds_.back()->SetRadii(point_radius_);
+    collisions_.AddPointCloud(pbds_.back().get());
+    selections_.emplace_back();
+  });
 }
 
 void Sandbox::SpawnRod(glm::dvec2 pos)
 {
-  const double rod_len = 0.5;
-  const int num_edges = 50;
-  const double stretch_resistance = 1.0;
-  const double bend_resistance = 1.0;
-  const double mass = 0.01;
-  pbds_.push_back(pbd::MakeRod(
-        rod_len, mass, num_edges,
-        stretch_resistance, bend_resistance));
-  const auto p = pbds_.back()->GetPoint(0);
-  pbds_.back()->DisplaceCloud(pos-p);
-  pbds_.back()->SetGravity({0,-9.82});
-  pbds_.back()->SetRadii(point_radius_);
-  collisions_.AddPointCloud(pbds_.back().get());
+  Post([this, pos]()
+  {
+    const double rod_len = 0.5;
+    const int num_edges = 50;
+    const double stretch_resistance = 1.0;
+    const double bend_resistance = 1.0;
+    const double mass = 0.01;
+    pbds_.push_back(pbd::MakeRod(
+          rod_len, mass, num_edges,
+          stretch_resistance, bend_resistance));
+    const auto p = pbds_.back()->GetPoint(0);
+    pbds_.back()->DisplaceCloud(pos-p);
+    pbds_.back()->SetGravity({0,-9.82});
+    pbds_.back()->SetRadii(point_radius_);
+    collisions_.AddPointCloud(pbds_.back().get());
+    selections_.emplace_back();
+  });
 }
 
-void Sandbox::SetRepellerForces()
+void Sandbox::SpawnSoftBody(glm::dvec2 pos)
 {
-  for (const auto& pbd : pbds_)
+  Post([this, pos]()
   {
-    for (int i = 0; i < pbd->GetNumPoints(); ++i)
-    {
-      const auto p = pbd->GetPoint(i);
-      const auto d = glm::length2(p-repeller_point_);
-      pbd->SetForce(i, 50.0*(p-repeller_point_)/d);
-    }
-  }
+    const double radius = 0.1;
+    const int num_vertices = 24;
+    const double mass = 0.05;
+    const double stiffness = 1.0;
+    const double pressure = 1.0;
+    pbds_.push_back(pbd::MakeSoftBody(
+          radius, num_vertices, mass, stiffness, pressure));
+    pbds_.back()->DisplaceCloud(pos);
+    pbds_.back()->SetGravity({0,-9.82});
+    pbds_.back()->SetRadii(point_radius_);
+    collisions_.AddPointCloud(pbds_.back().get());
+    selections_.emplace_back();
+  });
+}
+
+void Sandbox::SpawnRigidBox(glm::dvec2 pos)
+{
+  Post([this, pos]()
+  {
+    const double side_length = 0.1;
+    const int num_points_per_side = 4;
+    const double mass = 0.05;
+    const double stiffness = 1.0;
+    pbds_.push_back(pbd::MakeShapeMatchingBox(
+          side_length, side_length,
+          num_points_per_side, num_points_per_side,
+          mass, stiffness, pbd::ShapeMatchingMode::Rigid));
+    pbds_.back()->DisplaceCloud(pos);
+    pbds_.back()->SetGravity({0,-9.82});
+    pbds_.back()->SetRadii(point_radius_);
+    collisions_.AddPointCloud(pbds_.back().get());
+    selections_.emplace_back();
+  });
+}
+
+void Sandbox::SpawnCrate(glm::dvec2 pos)
+{
+  Post([this, pos]()
+  {
+    const double side_length = 0.1;
+    const double mass = 0.05;
+    rigid_bodies_.push_back(std::make_unique<pbd::RigidBody>(
+          pbd::MakeRigidBox(side_length, side_length, mass)));
+    rigid_bodies_.back()->SetPosition(pos);
+    rigid_bodies_.back()->SetGravity({0,-9.82});
+    collisions_.AddRigidBody(rigid_bodies_.back().get());
+  });
 }
 
 void Sandbox::EnableRepel()
 {
-  repel_ = true;
+  Post([this]()
+  {
+    if (repeller_field_ >= 0)
+      return;
+
+    pbd::ForceField field;
+    field.type = pbd::ForceFieldType::Radial;
+    field.center = repeller_point_;
+    field.direction = {0.0, 0.0};
+    field.strength = repeller_strength_;
+    field.radius = repeller_radius_;
+    repeller_field_ = force_fields_.AddField(field);
+  });
 }
 
 void Sandbox::DisableRepel()
 {
-  repel_ = false;
-  for (const auto& pbd : pbds_)
+  Post([this]()
   {
-    for (int i = 0; i < pbd->GetNumPoints(); ++i)
-    {
-      pbd->SetForce(i, {0.0, 0.0});
-    }
-  }
+    force_fields_.RemoveField(repeller_field_);
+    repeller_field_ = -1;
+  });
 }
 
 }
@@ -0,0 +1,215 @@
+#include "sandbox_hud.hpp"
+
+#include "SDL_FontCache.h"
+#include "profiler.hpp"
+#include "sandbox.hpp"
+
+#include <SDL2/SDL2_gfxPrimitives.h>
+
+#include <array>
+#include <cstdlib>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace sandbox
+{
+
+namespace
+{
+
+using pbd::profiler::Stage;
+constexpr int kNumStages = static_cast<int>(Stage::NumStages);
+
+FC_Font* font = nullptr;
+bool font_load_failed = false;
+
+const char* kFontPaths[] = {
+  "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf",
+  "/usr/share/fonts/TTF/DejaVuSansMono.ttf",
+  "/usr/share/fonts/dejavu/DejaVuSansMono.ttf",
+  "/System/Library/Fonts/Menlo.ttc",
+};
+
+FC_Font* GetFont(SDL_Renderer* renderer)
+{
+  if (font != nullptr || font_load_failed)
+  {
+    return font;
+  }
+
+  std::vector<const char*> paths;
+  if (const char* env = std::getenv("PBD2D_HUD_FONT"))
+  {
+    paths.push_back(env);
+  }
+  paths.insert(paths.end(), std::begin(kFontPaths), std::end(kFontPaths));
+
+  for (const auto path : paths)
+  {
+    font = FC_CreateFont();
+    if (FC_LoadFont(font, renderer, path, 14,
+          FC_MakeColor(255, 255, 255, 255), TTF_STYLE_NORMAL))
+    {
+      return font;
+    }
+    FC_FreeFont(font);
+    font = nullptr;
+  }
+
+  printf("HUD font could not be loaded, set PBD2D_HUD_FONT to a .ttf file\n");
+  font_load_failed = true;
+  return nullptr;
+}
+
+struct StageTimes
+{
+  std::array<double, kNumStages> ms{};
+  int num_steps = 0;
+};
+
+// Averages the per-stage durations of the most recent profiled substeps.
+StageTimes GetAverageStageTimes(int max_steps)
+{
+  StageTimes t;
+  const auto samples = pbd::profiler::GetSamples();
+  for (auto it = samples.rbegin(); it != samples.rend(); ++it)
+  {
+    t.ms[static_cast<int>(it->stage)] += 1e-6*it->duration_ns;
+    if (it->stage == Stage::Step && ++t.num_steps == max_steps)
+      break;
+  }
+
+  if (t.num_steps > 0)
+  {
+    for (auto& ms : t.ms)
+      ms /= t.num_steps;
+  }
+
+  return t;
+}
+
+void RenderFrameTimeHistogram(
+    const Sandbox& s, SDL_Renderer* renderer,
+    int x, int y, int height)
+{
+  const auto& frame_times = s.GetFrameTimes();
+  const int n = Sandbox::kFrameHistoryLength;
+  const int bar_width = 2;
+  const double max_ms = 50.0;
+
+  boxRGBA(renderer, x, y, x+n*bar_width, y+height, 0, 0, 0, 128);
+  for (int i = 0; i < n; ++i)
+  {
+    // Oldest frame on the left.
+    const int frame = s.GetFrameCount() - n + i;
+    if (frame < 0)
+      continue;
+
+    const double ms = 1000.0*frame_times[frame % n];
+    const int h = static_cast<int>(glm::min(ms/max_ms, 1.0)*height);
+    const int bx = x + i*bar_width;
+    if (ms < 1000.0/60.0)
+      boxRGBA(renderer, bx, y+height-h, bx+bar_width-1, y+height,
+              0, 200, 0, 255);
+    else if (ms < 1000.0/30.0)
+      boxRGBA(renderer, bx, y+height-h, bx+bar_width-1, y+height,
+              230, 200, 0, 255);
+    else
+      boxRGBA(renderer, bx, y+height-h, bx+bar_width-1, y+height,
+              220, 0, 0, 255);
+  }
+
+  const int y60 = y + height - static_cast<int>(1000.0/60.0/max_ms*height);
+  hlineRGBA(renderer, x, x+n*bar_width, y60, 255, 255, 255, 160);
+}
+
+}
+
+void RenderHud(const Sandbox& s, SDL_Window* window)
+{
+  auto renderer = SDL_GetRenderer(window);
+  Uint8 r,g,b,a;
+  SDL_GetRenderDrawColor(renderer,&r,&g,&b,&a);
+
+  const int x = 10;
+  const int y = 10;
+  const int width = 2*Sandbox::kFrameHistoryLength + 20;
+  const int histogram_height = 60;
+
+  const auto& snapshot = s.GetSnapshot();
+  int num_particles = 0;
+  int num_constraints = 0;
+  for (const auto& body : snapshot.bodies)
+  {
+    num_particles += body.points.size();
+    num_constraints += body.num_constraints;
+  }
+
+  const auto& frame_times = s.GetFrameTimes();
+  const int last_frame = glm::max(s.GetFrameCount()-1, 0);
+  const double frame_ms =
+      1000.0*frame_times[last_frame % Sandbox::kFrameHistoryLength];
+
+  std::vector<std::string> lines;
+  char buf[128];
+  snprintf(buf, sizeof(buf), "frame %6.2f ms  substeps %d%s",
+           frame_ms, s.GetNumSubstepsLastFrame(),
+           s.IsPhysicsThreaded() ? "  (threaded)" : "");
+  lines.push_back(buf);
+  snprintf(buf, sizeof(buf), "bodies %zu  particles %d",
+           snapshot.bodies.size(), num_particles);
+  lines.push_back(buf);
+  snprintf(buf, sizeof(buf), "constraints %d  contacts %d",
+           num_constraints, snapshot.num_contacts);
+  lines.push_back(buf);
+  snprintf(buf, sizeof(buf), "max error: length %.2e  bend %.2e",
+           snapshot.max_length_error, snapshot.max_bend_error);
+  lines.push_back(buf);
+  snprintf(buf, sizeof(buf), "max penetration %.2e  iterations %d",
+           snapshot.max_penetration, snapshot.num_solver_iterations);
+  lines.push_back(buf);
+
+  const auto stage_times = GetAverageStageTimes(60);
+  if (stage_times.num_steps == 0)
+  {
+    lines.push_back("stage timings: build with PBD2D_PROFILE");
+  }
+  for (int i = 0; i < kNumStages && stage_times.num_steps > 0; ++i)
+  {
+    snprintf(buf, sizeof(buf), "%-24s %7.3f ms",
+             pbd::profiler::GetStageName(static_cast<Stage>(i)),
+             stage_times.ms[i]);
+    lines.push_back(buf);
+  }
+
+  auto font = GetFont(renderer);
+  const int line_height = font != nullptr ? FC_GetLineHeight(font) : 0;
+  const int text_height = line_height*lines.size();
+  const int height = text_height + histogram_height + 30;
+
+  boxRGBA(renderer, x, y, x+width, y+height, 0, 0, 0, 160);
+  if (font != nullptr)
+  {
+    for (int i = 0; i < lines.size(); ++i)
+    {
+      FC_Draw(font, renderer, x+10, y+10+i*line_height, "%s",
+              lines[i].c_str());
+    }
+  }
+  RenderFrameTimeHistogram(
+      s, renderer, x+10, y+20+text_height, histogram_height);
+
+  SDL_SetRenderDrawColor(renderer,r,g,b,a);
+}
+
+void FreeHud()
+{
+  if (font != nullptr)
+  {
+    FC_FreeFont(font);
+    font = nullptr;
+  }
+}
+
+}
@@ -33,10 +33,25 @@ void KeyDown(Sandbox* s, SDL_Event e, glm::dvec2 cursor)
     case SDLK_r:
       s->SpawnRod(cursor);
       break;
+    case SDLK_b:
+      s->SpawnSoftBody(cursor);
+      break;
+    case SDLK_g:
+      s->SpawnRigidBox(cursor);
+      break;
+    case SDLK_x:
+      s->SpawnCrate(cursor);
+      break;
     case SDLK_f:
       s->SetRepellerPoint(cursor);
       s->EnableRepel();
       break;
+    case SDLK_h:
+      s->ToggleHud();
+      break;
+    case SDLK_t:
+      s->SetThreadedPhysics(!s->IsPhysicsThreaded());
+      break;
   }
 }
 
@@ -66,53 +81,48 @@ void KeyUp(Sandbox* s, SDL_Event e, glm::dvec2 cursor)
   }
 }
 
-void PixelDistanceToWorldCoordinate(
-    const Sandbox& s, SDL_Window* w,
-    glm::ivec2 pixel_coords,
-    glm::dvec2 world_coords,
-    int* dx, int* dy)
+void MouseDown(Sandbox* s, SDL_Window* w, int x, int y)
 {
-  const auto target_pixel = WorldToPixel(s, world_coords, w);
-  *dx = glm::abs(target_pixel.x - pixel_coords.x);
-  *dy = glm::abs(target_pixel.y - pixel_coords.y);
-}
+  const double tol = 20.0;
+  const auto view = GetViewTransform(*s, w);
+  const auto cursor = PixelToWorld(*s, w, {x,y});
+  const auto mod = SDL_GetModState();
 
-void SelectNearestPoint(
-    Sandbox* s,
-    SDL_Window* w,
-    glm::ivec2 pixel,
-    int tol)
-{
-  const auto& pbds = s->GetPbds();
-  const auto& selections = s->GetSelections();
+  if (mod & KMOD_SHIFT)
+  {
+    s->BeginRegionSelection(RegionMode::Box, cursor);
+    return;
+  }
+  if (mod & KMOD_CTRL)
+  {
+    s->BeginRegionSelection(RegionMode::Lasso, cursor);
+    return;
+  }
 
-  for (int pbd_idx = 0; pbd_idx < pbds.size(); ++pbd_idx)
+  // A click near the selection grabs it, a click elsewhere replaces it.
+  s->SetAttractorPoint(cursor);
+  const auto& selected = s->GetSnapshot().selected_points;
+  const auto pick_radius = tol/view.scale.x;
+  for (const auto& p : selected)
   {
-    const auto& pbd = pbds[pbd_idx];
-    const int num_pts = pbd->GetNumPoints();
-    for (int point_idx = 0; point_idx < num_pts; ++point_idx)
+    if (glm::distance(p, cursor) <= pick_radius)
     {
-      const auto p = pbd->GetPoint(point_idx);
-      const auto point_pixel = WorldToPixel(*s, p, w);
-      if (glm::abs(point_pixel.x-pixel.x) < tol &&
-          glm::abs(point_pixel.y-pixel.y) < tol)
-      {
-        s->SelectPoint(pbd_idx, point_idx, Selection::Selected);
-        return;
-      }
+      s->GrabSelection(cursor);
+      return;
     }
   }
-}
-
-void MouseDown(Sandbox* s, SDL_Window* w, int x, int y)
-{
-  int tol = 20;
-  s->SetAttractorPoint(PixelToWorld(*s, w, {x,y}));
-  SelectNearestPoint(s, w, {x,y}, tol);
+  if (!selected.empty())
+    s->DeselectAll();
+  s->SelectNearestPoint(cursor, pick_radius);
 }
 
 void MouseUp(Sandbox* s)
 {
+  if (s->IsSelectingRegion())
+  {
+    s->EndRegionSelection();
+    return;
+  }
   s->DeselectAll();
   s->DisableRepel();
 }
@@ -154,6 +164,11 @@ void EventHandler(Sandbox* s, SDL_Event e)
       break;
   }
 
+  if (e.type == SDL_MOUSEMOTION && s->IsSelectingRegion())
+  {
+    s->ExtendRegionSelection(PixelToWorld(*s, w, {e.motion.x, e.motion.y}));
+  }
+
   MouseMove(s, w, e.motion.x, e.motion.y);
 
   if (e.type == SDL_MOUSEWHEEL)
@@ -1,15 +1,88 @@
 #include "sandbox_render.hpp"
 
 #include <SDL2/SDL2_gfxPrimitives.h>
+#include <stdio.h>
 
 #include "sandbox.hpp"
+#include "sandbox_hud.hpp"
 #include "camera.hpp"
 #include "point_cloud.hpp"
 #include "pbd_system.hpp"
 
+#include <vector>
+
 namespace sandbox
 {
 
+namespace
+{
+
+const int kCircleTextureSize = 64;
+const double kMinSpriteRadius = 1.0;
+const SDL_Color kPointColor{255, 0, 0, 255};
+const SDL_Color kSelectionColor{0, 0, 255, 255};
+const SDL_Color kRigidBodyColor{0, 160, 0, 255};
+
+SDL_Texture* circle_texture = nullptr;
+bool circle_texture_failed = false;
+std::vector<SDL_Vertex> sprite_vertices;
+std::vector<int> sprite_indices;
+std::vector<SDL_FPoint> lod_points;
+
+// White anti-aliased disc, tinted per vertex when drawn.
+SDL_Texture* GetCircleTexture(SDL_Renderer* renderer)
+{
+  if (circle_texture != nullptr || circle_texture_failed)
+  {
+    return circle_texture;
+  }
+
+  const int n = kCircleTextureSize;
+  std::vector<Uint8> pixels(4*n*n);
+  for (int y = 0; y < n; ++y)
+  {
+    for (int x = 0; x < n; ++x)
+    {
+      const glm::dvec2 d{x+0.5-0.5*n, y+0.5-0.5*n};
+      const double coverage = glm::clamp(0.5*n - glm::length(d), 0.0, 1.0);
+      Uint8* px = &pixels[4*(y*n+x)];
+      px[0] = px[1] = px[2] = 255;
+      px[3] = static_cast<Uint8>(255.0*coverage);
+    }
+  }
+
+  circle_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
+      SDL_TEXTUREACCESS_STATIC, n, n);
+  if (circle_texture == nullptr ||
+      SDL_UpdateTexture(circle_texture, nullptr, pixels.data(), 4*n) != 0)
+  {
+    printf("Circle texture could not be created! SDL Error: %s\n",
+        SDL_GetError());
+    circle_texture_failed = true;
+    return nullptr;
+  }
+  SDL_SetTextureBlendMode(circle_texture, SDL_BLENDMODE_BLEND);
+
+  return circle_texture;
+}
+
+void AddSprite(glm::dvec2 center, float radius, SDL_Color color)
+{
+  const int base = sprite_vertices.size();
+  const float x = center.x;
+  const float y = center.y;
+  sprite_vertices.push_back({{x-radius, y-radius}, color, {0.0f, 0.0f}});
+  sprite_vertices.push_back({{x+radius, y-radius}, color, {1.0f, 0.0f}});
+  sprite_vertices.push_back({{x+radius, y+radius}, color, {1.0f, 1.0f}});
+  sprite_vertices.push_back({{x-radius, y+radius}, color, {0.0f, 1.0f}});
+  for (int i : {0, 1, 2, 0, 2, 3})
+  {
+    sprite_indices.push_back(base+i);
+  }
+}
+
+}
+
 glm::dvec2 WorldToNDC(
     const Sandbox& s,
     glm::dvec2 coords)
@@ -105,40 +178,170 @@ void RenderAxes(const Sandbox& s, SDL_Window* window)
   SDL_SetRenderDrawColor(renderer,r,g,b,a);
 }
 
-void RenderPointCloud(
+ViewTransform GetViewTransform(const Sandbox& s, SDL_Window* window)
+{
+  int width, height;
+  SDL_GetWindowSize(window, &width, &height);
+  const auto camera = s.GetCamera();
+  double left, right, top, bottom;
+  camera->GetLimits(&left, &right, &top, &bottom);
+
+  ViewTransform v;
+  v.center = camera->GetCenter();
+  v.scale = {width/(right-left), -height/(top-bottom)};
+  v.offset = {0.5*width, 0.5*height};
+  v.visible = {left, right, bottom, top};
+  return v;
+}
+
+// Draws a body whose particles are smaller than a pixel as single pixels,
+// skipping particles that land on the pixel just drawn. Morton ordered
+// bodies make consecutive particles likely to share pixels.
+void AddPointCloudLod(
+    const BodySnapshot& body,
+    const ViewTransform& view,
+    const geometry::Rect& visible)
+{
+  glm::ivec2 last_pixel{-1, -1};
+  for (const auto& p : body.points)
+  {
+    if (!geometry::RectContainsPoint(visible, p))
+      continue;
+
+    const auto pixel = WorldToPixel(view, p);
+    const glm::ivec2 ipixel{static_cast<int>(pixel.x),
+                            static_cast<int>(pixel.y)};
+    if (ipixel == last_pixel)
+      continue;
+
+    lod_points.push_back({static_cast<float>(pixel.x),
+                          static_cast<float>(pixel.y)});
+    last_pixel = ipixel;
+  }
+}
+
+// Submits every particle and selection as one textured quad batch.
+void RenderParticles(
+    const Sandbox& s,
+    const ViewTransform& view,
+    SDL_Window* window)
+{
+  auto renderer = SDL_GetRenderer(window);
+  const double point_radius = s.GetPointRadius();
+  const double pixel_radius = view.scale.x*point_radius;
+  const float radius = glm::max(pixel_radius, kMinSpriteRadius);
+  const bool sub_pixel = pixel_radius < kMinSpriteRadius;
+  const geometry::Rect visible{
+    view.visible.x1-point_radius, view.visible.x2+point_radius,
+    view.visible.y1-point_radius, view.visible.y2+point_radius};
+
+  sprite_vertices.clear();
+  sprite_indices.clear();
+  lod_points.clear();
+  const auto& snapshot = s.GetSnapshot();
+  for (const auto& body : snapshot.bodies)
+  {
+    const auto& box = body.bounding_box;
+    if (!geometry::RectsOverlap(box, visible))
+      continue;
+
+    if (sub_pixel)
+    {
+      AddPointCloudLod(body, view, visible);
+      continue;
+    }
+
+    const bool contained = geometry::RectContainsRect(visible, box);
+    for (const auto& p : body.points)
+    {
+      if (!contained && !geometry::RectContainsPoint(visible, p))
+        continue;
+      AddSprite(WorldToPixel(view, p), radius, kPointColor);
+    }
+  }
+
+  if (!lod_points.empty())
+  {
+    Uint8 r,g,b,a;
+    SDL_GetRenderDrawColor(renderer,&r,&g,&b,&a);
+    SDL_SetRenderDrawColor(renderer, kPointColor.r, kPointColor.g,
+        kPointColor.b, kPointColor.a);
+    SDL_RenderDrawPointsF(renderer, lod_points.data(), lod_points.size());
+    SDL_SetRenderDrawColor(renderer,r,g,b,a);
+  }
+  for (const auto& p : snapshot.selected_points)
+  {
+    AddSprite(WorldToPixel(view, p), radius, kSelectionColor);
+  }
+
+  auto texture = GetCircleTexture(renderer);
+  if (texture != nullptr && SDL_RenderGeometry(renderer, texture,
+        sprite_vertices.data(), sprite_vertices.size(),
+        sprite_indices.data(), sprite_indices.size()) == 0)
+  {
+    return;
+  }
+
+  // Fallback for renderers without geometry support.
+  for (int i = 0; i < sprite_vertices.size(); i += 4)
+  {
+    const auto& v = sprite_vertices[i];
+    const auto& c = v.color;
+    filledCircleRGBA(renderer,
+        v.position.x + radius, v.position.y + radius, radius,
+        c.r, c.g, c.b, c.a);
+  }
+}
+
+void RenderRegionOutline(
     const Sandbox& s,
-    const PointCloud* d,
+    const ViewTransform& view,
     SDL_Window* window)
 {
-  auto points = d->GetPoints();
+  const auto outline = s.GetRegionOutline();
+  if (outline.size() < 2)
+    return;
+
+  std::vector<SDL_FPoint> pixels;
+  for (const auto& p : outline)
+  {
+    const auto pixel = WorldToPixel(view, p);
+    pixels.push_back({static_cast<float>(pixel.x),
+                      static_cast<float>(pixel.y)});
+  }
+  pixels.push_back(pixels.front());
 
   auto renderer = SDL_GetRenderer(window);
   Uint8 r,g,b,a;
   SDL_GetRenderDrawColor(renderer,&r,&g,&b,&a);
-  for (const auto& p : points)
-  {
-    auto center = WorldToPixel(s, p, window);
-    auto radius = WorldLengthToPixelLength(s, s.GetPointRadius(), window);
-    filledCircleRGBA(renderer, center.x, center.y, radius, 255, 0, 0, 255);
-  }
+  SDL_SetRenderDrawColor(renderer, kSelectionColor.r, kSelectionColor.g,
+      kSelectionColor.b, kSelectionColor.a);
+  SDL_RenderDrawLinesF(renderer, pixels.data(), pixels.size());
   SDL_SetRenderDrawColor(renderer,r,g,b,a);
 }
 
-void RenderSelections(
+void RenderRigidBodies(
     const Sandbox& s,
+    const ViewTransform& view,
     SDL_Window* window)
 {
   auto renderer = SDL_GetRenderer(window);
   Uint8 r,g,b,a;
   SDL_GetRenderDrawColor(renderer,&r,&g,&b,&a);
-  for (const auto& sel : s.GetSelections())
+  SDL_SetRenderDrawColor(renderer, kRigidBodyColor.r, kRigidBodyColor.g,
+      kRigidBodyColor.b, kRigidBodyColor.a);
+  std::vector<SDL_FPoint> pixels;
+  for (const auto& outline : s.GetSnapshot().rigid_bodies)
   {
-    const auto pbd_idx = sel.first.first;
-    const auto point_idx = sel.first.second;
-    const auto point = s.GetPoint(pbd_idx, point_idx);
-    const auto pixel = WorldToPixel(s, point, window);
-    auto radius = WorldLengthToPixelLength(s, s.GetPointRadius(), window);
-    filledCircleRGBA(renderer, pixel.x, pixel.y, radius, 0, 0, 255, 255);
+    pixels.clear();
+    for (const auto& p : outline)
+    {
+      const auto pixel = WorldToPixel(view, p);
+      pixels.push_back({static_cast<float>(pixel.x),
+                        static_cast<float>(pixel.y)});
+    }
+    pixels.push_back(pixels.front());
+    SDL_RenderDrawLinesF(renderer, pixels.data(), pixels.size());
   }
   SDL_SetRenderDrawColor(renderer,r,g,b,a);
 }
@@ -149,12 +352,24 @@ void Render(const Sandbox& s, SDL_Window* window)
   SDL_RenderClear(renderer);
   SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
   RenderAxes(s, window);
-  for (const auto& pbd : s.GetPbds())
+  const auto view = GetViewTransform(s, window);
+  RenderParticles(s, view, window);
+  RenderRigidBodies(s, view, window);
+  RenderRegionOutline(s, view, window);
+  if (s.IsHudVisible())
   {
-    RenderPointCloud(s, pbd.get(), window);
+    RenderHud(s, window);
   }
-  RenderSelections(s, window);
   SDL_RenderPresent(renderer);
 }
 
+void FreeRenderResources()
+{
+  if (circle_texture != nullptr)
+  {
+    SDL_DestroyTexture(circle_texture);
+    circle_texture = nullptr;
+  }
+}
+
 }
@@ -0,0 +1,159 @@
+#include "shape_matching.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <utility>
+
+namespace pbd
+{
+
+namespace
+{
+
+Vec2 Rotate(Vec2 v, Real c, Real s)
+{
+  return {c*v.x - s*v.y, s*v.x + c*v.y};
+}
+
+// Weights of a particle in the fits of the center and of the rotation.
+// Pinned particles have infinite mass, so any of them alone fix the
+// center, and two or more fix the rotation as well.
+Real CenterWeight(Real mass, int num_pinned)
+{
+  if (num_pinned == 0)
+    return mass;
+  return std::isinf(mass) ? Real(1) : Real(0);
+}
+
+Real RotationWeight(Real mass, int num_pinned)
+{
+  if (num_pinned < 2)
+    return std::isinf(mass) ? Real(0) : mass;
+  return std::isinf(mass) ? Real(1) : Real(0);
+}
+
+}
+
+void ShapeMatchingConstraint::Project(ConstraintContext& ctx)
+{
+  const int n = indices.size();
+  if (n < 2)
+    return;
+
+  int num_pinned = 0;
+  for (const int idx : indices)
+  {
+    if (std::isinf(ctx.GetMass(idx)))
+      num_pinned += 1;
+  }
+  if (num_pinned == n)
+    return;
+
+  Vec2 center{0.0, 0.0};
+  Vec2 rest_center{0.0, 0.0};
+  Real total_weight = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    const auto w = CenterWeight(ctx.GetMass(indices[i]), num_pinned);
+    center += w*ctx.GetPoint(indices[i]);
+    rest_center += w*rest_offsets[i];
+    total_weight += w;
+  }
+  center /= total_weight;
+  rest_center /= total_weight;
+
+  // The rotation maximizing sum m_i p_i.(R q_i) for offsets p_i and rest
+  // offsets q_i has a closed form in 2D.
+  Real dot = 0;
+  Real cross = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    const auto m = RotationWeight(ctx.GetMass(indices[i]), num_pinned);
+    const auto p = ctx.GetPoint(indices[i]) - center;
+    const auto q = rest_offsets[i] - rest_center;
+    dot += m*(p.x*q.x + p.y*q.y);
+    cross += m*(p.y*q.x - p.x*q.y);
+  }
+  const auto angle = std::atan2(cross, dot);
+  const auto c = std::cos(angle);
+  const auto s = std::sin(angle);
+
+  // Masses enter through the fit, so pulling every free particle to its
+  // goal conserves momentum. Pinned particles are not moved.
+  bool yielded = false;
+  for (int i = 0; i < n; ++i)
+  {
+    if (std::isinf(ctx.GetMass(indices[i])))
+      continue;
+
+    const auto p = ctx.GetPoint(indices[i]);
+    const auto goal = center + Rotate(rest_offsets[i] - rest_center, c, s);
+    const auto d = goal - p;
+    ctx.Displace(indices[i], stiffness*d);
+
+    if (mode == ShapeMatchingMode::Plastic && glm::length(d) > yield)
+    {
+      const auto local = Rotate(p - center, c, -s) + rest_center;
+      rest_offsets[i] += creep*(local - rest_offsets[i]);
+      yielded = true;
+    }
+  }
+
+  if (!yielded)
+    return;
+
+  // Keep the rest shape centered on its center of mass.
+  Vec2 offset{0.0, 0.0};
+  for (int i = 0; i < n; ++i)
+  {
+    offset += CenterWeight(ctx.GetMass(indices[i]), num_pinned)*
+              rest_offsets[i];
+  }
+  offset /= total_weight;
+  for (auto& q : rest_offsets)
+  {
+    q -= offset;
+  }
+}
+
+void ShapeMatchingConstraint::RemapIndices(const std::vector<int>& old_to_new)
+{
+  for (auto& idx : indices)
+  {
+    idx = old_to_new[idx];
+  }
+}
+
+ShapeMatchingConstraint MakeShapeMatchingConstraint(
+    const PointCloud& pc, std::vector<int> indices, Real stiffness,
+    ShapeMatchingMode mode, Real yield, Real creep)
+{
+  int num_pinned = 0;
+  for (const int idx : indices)
+  {
+    if (std::isinf(pc.GetMass(idx)))
+      num_pinned += 1;
+  }
+
+  Vec2 center{0.0, 0.0};
+  Real total_weight = 0;
+  for (const int idx : indices)
+  {
+    const auto w = CenterWeight(pc.GetMass(idx), num_pinned);
+    center += w*pc.GetPoint(idx);
+    total_weight += w;
+  }
+  if (total_weight > 0)
+    center /= total_weight;
+
+  std::vector<Vec2> rest_offsets;
+  for (const int idx : indices)
+  {
+    rest_offsets.push_back(pc.GetPoint(idx) - center);
+  }
+  return {std::move(indices), std::move(rest_offsets),
+          stiffness, mode, yield, creep};
+}
+
+}
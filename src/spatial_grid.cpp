@@ -0,0 +1,37 @@
+#include "spatial_grid.hpp"
+
+namespace pbd
+{
+
+SpatialGrid::SpatialGrid(Real cell_size)
+  : cell_size_(cell_size)
+{
+}
+
+void SpatialGrid::SetCellSize(Real cell_size)
+{
+  cell_size_ = cell_size;
+  entries_.clear();
+}
+
+void SpatialGrid::Clear()
+{
+  entries_.clear();
+}
+
+void SpatialGrid::Insert(Vec2 p, int id)
+{
+  const auto c = GetCell(p);
+  entries_.push_back({GetKey(c.x, c.y), id});
+}
+
+void SpatialGrid::Build()
+{
+  std::sort(entries_.begin(), entries_.end(),
+      [](const Entry& a, const Entry& b)
+      {
+        return a.key < b.key || (a.key == b.key && a.id < b.id);
+      });
+}
+
+}